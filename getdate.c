@@ -1,5 +1,6 @@
 /*
- * getdate ascii_time ... - print the time_t of ascii_time(s)
+ * getdate [-b count] ascii_time ... - print the time_t of ascii_time(s);
+ * with -b, time count parses of each with and without the fast path
  */
 char ident[] = "@(#) getdate.c 3.2 09/06/24";
 #include <stdio.h>
@@ -34,9 +35,11 @@ extern struct tm *gmtime();
 extern time_t time();
 
 extern time_t parse();
+extern int fastparse;
 
 /* Forwards. */
 extern void process();
+extern void benchmark();
 
 /*
  - main - parse arguments and handle options
@@ -47,26 +50,35 @@ char *argv[];
 {
 	register int c;
 	register int errflg = 0;
+	long bench = 0;
 	extern int optind;
 	extern char *optarg;
 
 	progname = argv[0];
 	ftime(&ftnow);
 
-	while ((c = getopt(argc, argv, "")) != EOF)
+	while ((c = getopt(argc, argv, "b:")) != EOF)
 		switch (c) {
+		case 'b':
+			bench = atol(optarg);
+			if (bench <= 0)
+				errflg++;
+			break;
 		case '?':
 		default:
 			errflg++;
 			break;
 		}
 	if (errflg || optind == argc) {
-		(void) fprintf(stderr, "Usage: %s ascii_time ...\n", progname);
+		(void) fprintf(stderr, "Usage: %s [-b count] ascii_time ...\n", progname);
 		exit(2);
 	}
 
 	for (; optind < argc; optind++)
-		process(argv[optind]);
+		if (bench)
+			benchmark(argv[optind], bench);
+		else
+			process(argv[optind]);
 	exit(exitstatus);
 }
 
@@ -89,3 +101,31 @@ char *tm;
 	} else
 		(void) printf("%ld\n", it);
 }
+
+/*
+ * benchmark - time count parses of tm, with and without the fast path
+ */
+void
+benchmark(tm, count)
+char *tm;
+long count;
+{
+	struct timespec t0, t1;
+	time_t it[2];
+	double ns[2];
+	long i;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		fastparse = !pass;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < count; i++)
+			it[pass] = parse(tm, &ftnow);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns[pass] = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+		    (t1.tv_nsec - t0.tv_nsec)) / count;
+	}
+	fastparse = 1;
+	(void) printf("%s: fast %ld in %.0f ns, grammar %ld in %.0f ns\n",
+	    tm, it[0], ns[0], it[1], ns[1]);
+}
@@ -0,0 +1,234 @@
+/*
+ * growth - one detector step of memmon over every slot of a struct cols:
+ * bump the growth count of what grew, reset it on a shrink, and list
+ * what reached its thresholds.  The scalar loop is the reference; the
+ * SSE2, AVX2 and AVX-512 passes do the same without a branch per slot,
+ * picked at run time by what the CPU has.
+ */
+char gident[] = "@(#) growth.c 1.1 26/10/19";
+#include <stdio.h>
+#include <string.h>
+#include "growth.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define	X86
+#include <immintrin.h>
+#endif
+
+/*
+ - pass_scalar - the reference: memmon's merge loop, one slot at a time
+ */
+static void
+pass_scalar(struct cols *c, int n, struct hits *h)
+{
+	int i, d;
+
+	for (i = 0; i < n; i++) {
+		if (!c->here[i])
+			continue;
+		if (c->live[i]) {
+			d = c->cur[i] - c->prev[i];
+			if (d >= c->rate[i]) {
+				if (++c->grw[i] >= c->thr[i] &&
+				    c->cur[i] - c->init[i] >= c->min[i])
+					h->grown[h->ngrown++] = i;
+			} else if (d < 0)
+				c->grw[i] = 0;
+		}
+		if (c->max[i] > 0 && c->cur[i] > c->max[i])
+			h->capped[h->ncapped++] = i;
+		c->prev[i] = c->cur[i];
+	}
+}
+
+#ifdef X86
+/* append the lanes set in mask m of the block at i to list l */
+#define	EMIT(l, nl, m, i)	for (; m; m &= m - 1) \
+					(l)[(nl)++] = (i) + __builtin_ctz(m)
+
+#define	LD4(p)		_mm_loadu_si128((__m128i *) (p))
+#define	ST4(p, v)	_mm_storeu_si128((__m128i *) (p), v)
+
+/*
+ - pass_sse2 - four slots a step
+ */
+__attribute__((target("sse2")))
+static void
+pass_sse2(struct cols *c, int n, struct hits *h)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i here, live, cur, prev, d, up, down, g, mx, fg, fc;
+	unsigned m;
+	int i;
+
+	for (i = 0; i < n; i += 4) {
+		here = LD4(c->here + i);
+		if (_mm_movemask_epi8(here) == 0)
+			continue;
+		live = LD4(c->live + i);
+		cur = LD4(c->cur + i);
+		prev = LD4(c->prev + i);
+		d = _mm_sub_epi32(cur, prev);
+		up = _mm_andnot_si128(_mm_cmpgt_epi32(LD4(c->rate + i), d), live);
+		down = _mm_andnot_si128(up, _mm_and_si128(live,
+		    _mm_cmpgt_epi32(zero, d)));
+		g = _mm_andnot_si128(down, _mm_sub_epi32(LD4(c->grw + i), up));
+		ST4(c->grw + i, g);
+		fg = _mm_andnot_si128(_mm_cmpgt_epi32(LD4(c->thr + i), g), up);
+		fg = _mm_andnot_si128(_mm_cmpgt_epi32(LD4(c->min + i),
+		    _mm_sub_epi32(cur, LD4(c->init + i))), fg);
+		mx = LD4(c->max + i);
+		fc = _mm_and_si128(here, _mm_and_si128(_mm_cmpgt_epi32(mx, zero),
+		    _mm_cmpgt_epi32(cur, mx)));
+		ST4(c->prev + i, _mm_or_si128(_mm_and_si128(here, cur),
+		    _mm_andnot_si128(here, prev)));
+		m = _mm_movemask_ps(_mm_castsi128_ps(fg));
+		EMIT(h->grown, h->ngrown, m, i);
+		m = _mm_movemask_ps(_mm_castsi128_ps(fc));
+		EMIT(h->capped, h->ncapped, m, i);
+	}
+}
+
+#define	LD8(p)		_mm256_loadu_si256((__m256i *) (p))
+#define	ST8(p, v)	_mm256_storeu_si256((__m256i *) (p), v)
+
+/*
+ - pass_avx2 - eight slots a step
+ */
+__attribute__((target("avx2")))
+static void
+pass_avx2(struct cols *c, int n, struct hits *h)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i here, live, cur, prev, d, up, down, g, mx, fg, fc;
+	unsigned m;
+	int i;
+
+	for (i = 0; i < n; i += 8) {
+		here = LD8(c->here + i);
+		if (_mm256_testz_si256(here, here))
+			continue;
+		live = LD8(c->live + i);
+		cur = LD8(c->cur + i);
+		prev = LD8(c->prev + i);
+		d = _mm256_sub_epi32(cur, prev);
+		up = _mm256_andnot_si256(_mm256_cmpgt_epi32(LD8(c->rate + i), d), live);
+		down = _mm256_andnot_si256(up, _mm256_and_si256(live,
+		    _mm256_cmpgt_epi32(zero, d)));
+		g = _mm256_andnot_si256(down, _mm256_sub_epi32(LD8(c->grw + i), up));
+		ST8(c->grw + i, g);
+		fg = _mm256_andnot_si256(_mm256_cmpgt_epi32(LD8(c->thr + i), g), up);
+		fg = _mm256_andnot_si256(_mm256_cmpgt_epi32(LD8(c->min + i),
+		    _mm256_sub_epi32(cur, LD8(c->init + i))), fg);
+		mx = LD8(c->max + i);
+		fc = _mm256_and_si256(here, _mm256_and_si256(
+		    _mm256_cmpgt_epi32(mx, zero), _mm256_cmpgt_epi32(cur, mx)));
+		ST8(c->prev + i, _mm256_blendv_epi8(prev, cur, here));
+		m = _mm256_movemask_ps(_mm256_castsi256_ps(fg));
+		EMIT(h->grown, h->ngrown, m, i);
+		m = _mm256_movemask_ps(_mm256_castsi256_ps(fc));
+		EMIT(h->capped, h->ncapped, m, i);
+	}
+}
+
+#define	LD16(p)		_mm512_loadu_si512((void *) (p))
+#define	ST16(p, v)	_mm512_storeu_si512((void *) (p), v)
+
+/*
+ - pass_avx512 - sixteen slots a step, the flagged slot numbers written
+ - out with a compressing store instead of a walk over the mask bits
+ */
+__attribute__((target("avx512f")))
+static void
+pass_avx512(struct cols *c, int n, struct hits *h)
+{
+	__m512i zero = _mm512_setzero_si512(), one = _mm512_set1_epi32(1);
+	__m512i sixteen = _mm512_set1_epi32(16);
+	__m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+	    8, 9, 10, 11, 12, 13, 14, 15);
+	__m512i cur, prev, g, mx;
+	__mmask16 here, live, up, down, fg, fc;
+	int i;
+
+	for (i = 0; i < n; i += 16, idx = _mm512_add_epi32(idx, sixteen)) {
+		here = _mm512_test_epi32_mask(LD16(c->here + i), LD16(c->here + i));
+		if (here == 0)
+			continue;
+		live = _mm512_test_epi32_mask(LD16(c->live + i), LD16(c->live + i));
+		cur = LD16(c->cur + i);
+		prev = LD16(c->prev + i);
+		up = _mm512_mask_cmpge_epi32_mask(live,
+		    _mm512_sub_epi32(cur, prev), LD16(c->rate + i));
+		down = _mm512_mask_cmplt_epi32_mask(live & ~up, cur, prev);
+		g = LD16(c->grw + i);
+		g = _mm512_mask_add_epi32(g, up, g, one);
+		g = _mm512_mask_mov_epi32(g, down, zero);
+		ST16(c->grw + i, g);
+		fg = _mm512_mask_cmpge_epi32_mask(up, g, LD16(c->thr + i));
+		fg = _mm512_mask_cmpge_epi32_mask(fg,
+		    _mm512_sub_epi32(cur, LD16(c->init + i)), LD16(c->min + i));
+		mx = LD16(c->max + i);
+		fc = _mm512_mask_cmpgt_epi32_mask(here, mx, zero);
+		fc = _mm512_mask_cmpgt_epi32_mask(fc, cur, mx);
+		ST16(c->prev + i, _mm512_mask_mov_epi32(prev, here, cur));
+		_mm512_mask_compressstoreu_epi32(h->grown + h->ngrown, fg, idx);
+		h->ngrown += __builtin_popcount(fg);
+		_mm512_mask_compressstoreu_epi32(h->capped + h->ncapped, fc, idx);
+		h->ncapped += __builtin_popcount(fc);
+	}
+}
+#endif
+
+static struct pass {
+	char	*name;
+	void	(*fn)(struct cols *, int, struct hits *);
+	int	usable;
+} passes[] = {
+#ifdef X86
+	{ "avx512",	pass_avx512 },
+	{ "avx2",	pass_avx2 },
+	{ "sse2",	pass_sse2 },
+#endif
+	{ "scalar",	pass_scalar,	1 },
+};
+#define	NPASS	(sizeof(passes) / sizeof(passes[0]))
+
+static struct pass *chosen;
+
+/*
+ - growth_select - use the named pass, or the widest the CPU can run if
+ - name is NULL; returns the name of the pass, or NULL if it cannot run
+ */
+char *
+growth_select(char *name)
+{
+	int i;
+
+#ifdef X86
+	__builtin_cpu_init();
+	passes[0].usable = __builtin_cpu_supports("avx512f");
+	passes[1].usable = __builtin_cpu_supports("avx2");
+	passes[2].usable = __builtin_cpu_supports("sse2");
+#endif
+	for (i = 0; i < NPASS; i++)
+		if (passes[i].usable &&
+		    (name == NULL || strcmp(name, passes[i].name) == 0)) {
+			chosen = &passes[i];
+			return chosen->name;
+		}
+	return NULL;
+}
+
+/*
+ - growth_pass - run one detector step over the first n slots; the
+ - columns must be padded to a multiple of LANES with here 0, and the
+ - hit lists must have room for n entries each
+ */
+void
+growth_pass(struct cols *c, int n, struct hits *h)
+{
+	if (chosen == NULL)
+		(void) growth_select(NULL);
+	h->ngrown = h->ncapped = 0;
+	(*chosen->fn)(c, (n + LANES - 1) / LANES * LANES, h);
+}
@@ -0,0 +1,38 @@
+/*
+ * growth.h - the memmon growth detector as a kernel over columns
+ * @(#) growth.h 1.1 26/10/19
+ */
+
+#define	LANES	16		/* columns are padded to a multiple of this */
+
+/*
+ * The per-process state, one column per field and one slot per process.
+ * here and live are 0 or -1: here if the slot is in this snapshot, live
+ * if it was also in the last one under the same name.  Sizes are pages,
+ * clamped below 2^31.
+ */
+struct cols {
+	int	*cur;		/* size in this snapshot */
+	int	*prev;		/* size in the last one */
+	int	*init;		/* size when first seen */
+	int	*grw;		/* growth count */
+	int	*thr;		/* growth count to flag at (g=) */
+	int	*rate;		/* smallest increase that counts (rate=) */
+	int	*min;		/* total growth to flag at (min=) */
+	int	*max;		/* size to flag above, or 0 (max=) */
+	int	*here;
+	int	*live;
+};
+
+/*
+ * The slots flagged by one pass, in slot order.
+ */
+struct hits {
+	int	*grown;
+	int	ngrown;
+	int	*capped;
+	int	ncapped;
+};
+
+extern char *growth_select();
+extern void growth_pass();
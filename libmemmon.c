@@ -0,0 +1,1703 @@
+/*
+ * libmemmon - memmon as a library: the merge_cycle detector of memmon
+ * over a pid table kept in memory between cycles, the filter rules of
+ * Policy_awk, the state file format and a /proc collector.  See memmon.h.
+ *
+ * The processes it tracks live in slabs of SLAB slots that are never
+ * moved or freed; what a cycle needs only while it runs, the parent
+ * index and its scratch arrays, comes from an arena that mm_begin
+ * resets.  An arena that ran short spills to malloc for the rest of the
+ * cycle and is resized at the next reset, so that it settles at what
+ * the cycles need.
+ *
+ * mm_run puts the collector, the detector and the sink on threads of
+ * their own, joined by rings of one producer and one consumer that pass
+ * batches, a cycle each, round: collector to detector to sink and back
+ * to the collector.  There are NBATCH batches; a collector that finds
+ * none back at its next tick skips that cycle and counts it, so that a
+ * stalled sink costs cycles rather than the cadence.
+ */
+#define	_GNU_SOURCE
+char lident[] = "@(#) libmemmon.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "memmon.h"
+#include "procstat.h"
+
+#define	NAMESZ		64
+#define	BUFSZ		1024
+#define	STATUSSZ	8192
+#define	DENTSZ		32768
+#define	TASK_BUDGET	4096	/* task entries mm_sample walks a cycle */
+#define	NIL		(-1)
+#define	HASH(pid, m)	(((unsigned) (pid) * 2654435761u >> 7) & (m))
+#define	SLAB		256	/* slots a slab */
+#define	SLOT(mm, i)	(&(mm)->slabs[(i) / SLAB][(i) % SLAB])
+#define	ARENA_ALIGN	16
+#define	ARENA_ROUND	65536
+#define	MSGSZ		512
+#define	NBATCH		4	/* cycles mm_run has in flight */
+#define	NRING		8	/* a power of 2 above NBATCH, for the end */
+
+/*
+ * A filter rule; -1, or a NULL category, leaves the setting to the
+ * handle so that mm_set can come before or after the filter.
+ */
+struct rule {
+	char	*name;		/* a name or a shell pattern */
+	int	pattern;
+	int	ign;
+	int	g, p, w;
+	long	min, rate, max;
+	char	*c;
+	int	tree;		/* watch it with its descendants */
+	int	threads;	/* and its thread count */
+	int	numa;		/* and its pages on each NUMA node */
+};
+
+/*
+ * A process of this cycle in the parent index, ignored or not.  tot is
+ * its size with that of all its descendants once the cycle is totalled.
+ */
+struct node {
+	int	pid, ppid;
+	long	size, faults, tot;
+	long	threads, vsize;	/* from stat, for threads rules */
+	int	nch;		/* children not yet added in */
+	int	next;		/* hash chain */
+	char	name[NAMESZ];
+};
+
+/*
+ * A process in the table.
+ */
+struct slot {
+	struct mm_proc p;
+	char	name[NAMESZ];
+	int	rule;
+	int	index;		/* in the slabs */
+	unsigned long gen;	/* last cycle it was in */
+};
+
+/*
+ * An alert of mm_run, copied for the sink; the pointers are set by the
+ * sink, once the batch has stopped growing.
+ */
+struct qalert {
+	struct mm_alert a;
+	struct mm_proc p;
+	char	name[NAMESZ];
+	char	msg[MSGSZ];
+};
+
+/*
+ * A cycle: the records the collector read, which the detector then
+ * uses as its parent index, and under mm_run the alerts it raised and
+ * the records it left, for the sink.
+ */
+struct batch {
+	struct node *recs;
+	int	nrecs, maxrecs;	/* maxrecs a power of 2 */
+	time_t	now;		/* when it was collected */
+	struct timespec at;
+	long	dropped;	/* cycles skipped just before it */
+	struct qalert *alerts;
+	int	nalerts, maxalerts;
+	struct slot *state;
+	int	nstate, maxstate;
+	time_t	last;
+	struct mm_counts n;
+};
+
+/*
+ * The buffers a collector reads /proc through.
+ */
+struct reader {
+	char	stat[BUFSZ], statm[BUFSZ];
+	char	dents[DENTSZ];
+};
+
+/*
+ * A ring of one producer and one consumer.  head and tail run free;
+ * only the producer stores head and only the consumer tail, and as no
+ * more than NBATCH batches and the end mark are ever in a ring it is
+ * never full.  A consumer with nothing to take waits on head.
+ */
+struct ring {
+	struct batch *b[NRING];
+	unsigned int head, tail;
+};
+
+struct memmon {
+	int	growth, priority;
+	char	category[NAMESZ];
+	long	pagesize;
+	struct rule *rules;
+	int	nrules;
+	mm_alert_fn *alert;
+	void	*arg;
+
+	struct slot **slabs;
+	int	nslabs, maxslots;
+	int	maxindex;	/* slots freel and order have room for */
+	int	*freel, nfree;	/* unused slots */
+	int	*tab, tmask;	/* pid to slot, linear probing */
+	int	*order, norder;	/* slots fed this cycle, in order */
+	unsigned long gen;
+	long	elapsed;
+	int	ntree;		/* rules with tree */
+	int	nthreaded;	/* rules with threads */
+	int	numa;		/* NUMA nodes, 0 on a host with one */
+	long	budget;		/* task entries mm_sample walks */
+	long	th, vs;		/* mm_threads of the next mm_feed */
+	struct node *nodes;
+	int	nnodes, maxnodes;
+	int	nodehint;	/* nodes the last cycle had room for */
+	int	*nhash, *stack;	/* maxnodes each */
+	int	totalled;
+	long	limit;		/* processes tracked, 0 for all */
+	long	cutoff;		/* smallest size tracked this cycle */
+	int	cut;		/* cutoff worked out */
+	char	*arena;		/* for this cycle */
+	size_t	asize, aused, aneed;
+	void	*spill;		/* what did not fit, freed at the reset */
+	time_t	last;		/* when the last cycle began */
+	struct mm_counts n;
+
+	char	msg[MSGSZ];
+	char	status[STATUSSZ];
+	struct batch own;	/* of mm_sample */
+	struct reader rd;
+};
+
+struct pipeline {
+	struct memmon *mm;
+	long	interval, cycles;
+	const char *path;
+	struct ring full;	/* collector to detector */
+	struct ring done;	/* detector to sink */
+	struct ring free;	/* sink to collector */
+	struct batch batch[NBATCH];
+	struct reader rd;
+	mm_alert_fn *fn;
+	void	*arg;
+	int	stop;		/* the errno of a stage that failed */
+};
+
+static int grow(struct memmon *);
+static int policy(struct memmon *, const char *);
+static void arena_reset(struct memmon *);
+static int readfile(const char *, char *);
+
+/*
+ - mm_open - a handle with memmon's defaults: -g 10, -p 3, -c memmon
+ */
+struct memmon *
+mm_open(void)
+{
+	struct memmon *mm;
+	char path[48];
+	int i, n;
+
+	if ((mm = calloc(1, sizeof(*mm))) == NULL)
+		return NULL;
+	/* numa rules only read anything with two of the first MM_NODES */
+	for (i = n = 0; i < MM_NODES; i++) {
+		(void) sprintf(path, "/sys/devices/system/node/node%d", i);
+		if (access(path, F_OK) == 0) {
+			n++;
+			mm->numa = i + 1;
+		}
+	}
+	if (n < 2)
+		mm->numa = 0;
+	mm->growth = 10;
+	mm->priority = 3;
+	mm->budget = TASK_BUDGET;
+	(void) strcpy(mm->category, "memmon");
+	if ((mm->pagesize = sysconf(_SC_PAGESIZE)) <= 0)
+		mm->pagesize = 4096;
+	mm->tmask = -1;
+	if (grow(mm) < 0) {
+		free(mm);
+		return NULL;
+	}
+	return mm;
+}
+
+static void
+free_rules(struct memmon *mm)
+{
+	int i;
+
+	for (i = 0; i < mm->nrules; i++) {
+		free(mm->rules[i].name);
+		free(mm->rules[i].c);
+	}
+	free(mm->rules);
+	mm->rules = NULL;
+	mm->nrules = mm->ntree = mm->nthreaded = 0;
+}
+
+/*
+ - mm_close - free the handle
+ */
+void
+mm_close(struct memmon *mm)
+{
+	if (mm == NULL)
+		return;
+	free_rules(mm);
+	while (mm->nslabs > 0)
+		free(mm->slabs[--mm->nslabs]);
+	free(mm->slabs);
+	free(mm->freel);
+	free(mm->tab);
+	free(mm->order);
+	free(mm->own.recs);
+	mm->aneed = 0;
+	arena_reset(mm);
+	free(mm->arena);
+	free(mm);
+}
+
+/*
+ - pages - a size in pages, or bytes with a K, M or G suffix, rounded up
+ */
+static long
+pages(struct memmon *mm, char *x)
+{
+	size_t n = strlen(x);
+	double m = 0;
+
+	if (n > 0)
+		switch (toupper((unsigned char) x[n - 1])) {
+		case 'K': m = 1024; break;
+		case 'M': m = 1048576; break;
+		case 'G': m = 1073741824; break;
+		}
+	if (m == 0)
+		return atol(x);
+	return (long) ((strtod(x, NULL) * m + mm->pagesize - 1) / mm->pagesize);
+}
+
+/*
+ - load_filter - replace the rules with those of a memfilt file
+ */
+static int
+load_filter(struct memmon *mm, const char *path)
+{
+	FILE *fp;
+	char line[BUFSZ], *f[64], *p, *v;
+	struct rule *r, *nr;
+	int nf, i;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	free_rules(mm);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (nf = 0, p = strtok(line, " \t\n"); p != NULL && nf < 64;
+		    p = strtok(NULL, " \t\n"))
+			f[nf++] = p;
+		if (nf == 0)
+			continue;
+		if ((nr = realloc(mm->rules, (mm->nrules + 1) * sizeof(*nr))) == NULL)
+			goto nomem;
+		mm->rules = nr;
+		r = &mm->rules[mm->nrules];
+		(void) memset(r, 0, sizeof(*r));
+		r->g = r->p = r->w = -1;
+		r->rate = 1;
+		r->ign = nf == 1;
+		r->pattern = strpbrk(f[0], "*?[") != NULL;
+		if ((r->name = strdup(f[0])) == NULL)
+			goto nomem;
+		mm->nrules++;
+		for (i = 1; i < nf; i++) {
+			v = "";
+			if ((p = strchr(f[i], '=')) != NULL) {
+				*p = '\0';
+				v = p + 1;
+			}
+			if (strcmp(f[i], "ignore") == 0)
+				r->ign = 1;
+			else if (strcmp(f[i], "g") == 0)
+				r->g = atoi(v);
+			else if (strcmp(f[i], "p") == 0)
+				r->p = atoi(v);
+			else if (strcmp(f[i], "c") == 0) {
+				free(r->c);
+				if ((r->c = strdup(v)) == NULL)
+					goto nomem;
+			} else if (strcmp(f[i], "min") == 0)
+				r->min = pages(mm, v);
+			else if (strcmp(f[i], "rate") == 0)
+				r->rate = pages(mm, v);
+			else if (strcmp(f[i], "max") == 0)
+				r->max = pages(mm, v);
+			else if (strcmp(f[i], "w") == 0)
+				r->w = atoi(v);
+			else if (strcmp(f[i], "tree") == 0 && !r->tree) {
+				r->tree = 1;
+				mm->ntree++;
+			} else if (strcmp(f[i], "threads") == 0 && !r->threads) {
+				r->threads = 1;
+				mm->nthreaded++;
+			} else if (strcmp(f[i], "numa") == 0)
+				r->numa = 1;
+		}
+	}
+	(void) fclose(fp);
+	for (i = 0; i < mm->maxslots; i++)
+		SLOT(mm, i)->rule = 0;
+	for (i = 0; i <= mm->tmask; i++)
+		if (mm->tab[i] != NIL)
+			SLOT(mm, mm->tab[i])->rule = policy(mm,
+			    SLOT(mm, mm->tab[i])->name);
+	return 0;
+nomem:
+	(void) fclose(fp);
+	free_rules(mm);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*
+ - mm_set - set growth, priority, category, filter (a memfilt path),
+ - budget (task entries mm_sample walks a cycle) or limit (processes
+ - tracked, the largest, 0 for all)
+ */
+int
+mm_set(struct memmon *mm, const char *key, const char *value)
+{
+	if (strcmp(key, "growth") == 0 && atoi(value) > 0)
+		mm->growth = atoi(value);
+	else if (strcmp(key, "priority") == 0 && atoi(value) >= 1 &&
+	    atoi(value) <= 10)
+		mm->priority = atoi(value);
+	else if (strcmp(key, "category") == 0 && *value &&
+	    strlen(value) < NAMESZ)
+		(void) strcpy(mm->category, value);
+	else if (strcmp(key, "filter") == 0)
+		return load_filter(mm, value);
+	else if (strcmp(key, "budget") == 0 && atol(value) >= 0)
+		mm->budget = atol(value);
+	else if (strcmp(key, "limit") == 0 && atol(value) >= 0)
+		mm->limit = atol(value);
+	else {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ - mm_alerts - call fn with arg for every alert from now on
+ */
+void
+mm_alerts(struct memmon *mm, mm_alert_fn *fn, void *arg)
+{
+	mm->alert = fn;
+	mm->arg = arg;
+}
+
+/*
+ - policy - the rule of a process name: 0 for none, else the exact rule
+ - for the name, else the first pattern that matches
+ */
+static int
+policy(struct memmon *mm, const char *name)
+{
+	int i;
+
+	for (i = 0; i < mm->nrules; i++)
+		if (!mm->rules[i].pattern && strcmp(mm->rules[i].name, name) == 0)
+			return i + 1;
+	for (i = 0; i < mm->nrules; i++)
+		if (mm->rules[i].pattern && fnmatch(mm->rules[i].name, name, 0) == 0)
+			return i + 1;
+	return 0;
+}
+
+/*
+ - rehash - double the pid table and the lists of slots
+ */
+static int
+rehash(struct memmon *mm)
+{
+	int max = mm->maxindex ? mm->maxindex * 2 : 1024;
+	int mask = max * 2 - 1, i, h;
+	int *freel, *tab, *order;
+
+	if ((freel = realloc(mm->freel, max * sizeof(int))) == NULL)
+		return -1;
+	mm->freel = freel;
+	if ((order = realloc(mm->order, max * sizeof(int))) == NULL)
+		return -1;
+	mm->order = order;
+	if ((tab = malloc((mask + 1) * sizeof(int))) == NULL)
+		return -1;
+	for (i = 0; i <= mask; i++)
+		tab[i] = NIL;
+	for (i = 0; i <= mm->tmask; i++)
+		if (mm->tab[i] != NIL) {
+			for (h = HASH(SLOT(mm, mm->tab[i])->p.pid, mask);
+			    tab[h] != NIL; h = (h + 1) & mask)
+				;
+			tab[h] = mm->tab[i];
+		}
+	free(mm->tab);
+	mm->tab = tab;
+	mm->tmask = mask;
+	mm->maxindex = max;
+	return 0;
+}
+
+/*
+ - grow - add a slab of slots, and room for them in the pid table; the
+ - only allocation a cycle makes, and only when there are more processes
+ - than ever before
+ */
+static int
+grow(struct memmon *mm)
+{
+	struct slot **sl, *s;
+	int i;
+
+	if (mm->maxslots + SLAB > mm->maxindex && rehash(mm) < 0)
+		return -1;
+	if ((sl = realloc(mm->slabs, (mm->nslabs + 1) * sizeof(*sl))) == NULL)
+		return -1;
+	mm->slabs = sl;
+	if ((s = malloc(SLAB * sizeof(*s))) == NULL)
+		return -1;
+	sl[mm->nslabs++] = s;
+	/* the new slots are free, the lowest handed out first */
+	for (i = SLAB - 1; i >= 0; i--) {
+		s[i].index = mm->maxslots + i;
+		s[i].p.name = s[i].name;
+		mm->freel[mm->nfree++] = mm->maxslots + i;
+	}
+	mm->maxslots += SLAB;
+	return 0;
+}
+
+/*
+ - lookup - the table position of pid, or of the hole it would go in
+ */
+static int
+lookup(struct memmon *mm, int pid)
+{
+	int h;
+
+	for (h = HASH(pid, mm->tmask); mm->tab[h] != NIL &&
+	    SLOT(mm, mm->tab[h])->p.pid != pid; h = (h + 1) & mm->tmask)
+		;
+	return h;
+}
+
+/*
+ - drop - take the slot at table position h out, shifting back the
+ - entries after it that would otherwise be cut off from their hash
+ */
+static void
+drop(struct memmon *mm, int h)
+{
+	int i, j, k;
+
+	mm->freel[mm->nfree++] = mm->tab[h];
+	mm->tab[h] = NIL;
+	for (i = h, j = (h + 1) & mm->tmask; mm->tab[j] != NIL;
+	    j = (j + 1) & mm->tmask) {
+		k = HASH(SLOT(mm, mm->tab[j])->p.pid, mm->tmask);
+		/* move j to i unless k lies cyclically in (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		mm->tab[i] = mm->tab[j];
+		mm->tab[j] = NIL;
+		i = j;
+	}
+}
+
+/*
+ - enter - a fresh slot for pid at table position h
+ */
+static struct slot *
+enter(struct memmon *mm, int pid, const char *name, int h)
+{
+	struct slot *s;
+
+	if (mm->nfree == 0) {
+		if (grow(mm) < 0)
+			return NULL;
+		h = lookup(mm, pid);
+	}
+	mm->tab[h] = mm->freel[--mm->nfree];
+	s = SLOT(mm, mm->tab[h]);
+	(void) memset(&s->p, 0, sizeof(s->p));
+	s->p.pid = pid;
+	s->p.name = s->name;
+	(void) snprintf(s->name, NAMESZ, "%s", name);
+	s->rule = policy(mm, s->name);
+	return s;
+}
+
+/*
+ - mm_load - read a state file: memmon-stats line and records
+ */
+int
+mm_load(struct memmon *mm, const char *path)
+{
+	FILE *fp;
+	char line[BUFSZ], *f[16], *p;
+	struct slot *s;
+	int nf, h, k;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "PID memmon-stats", 16) == 0) {
+			if ((p = strstr(line, " time=")) != NULL)
+				mm->last = atol(p + 6);
+			continue;
+		}
+		for (nf = 0, p = strtok(line, " \t\n"); p != NULL && nf < 16;
+		    p = strtok(NULL, " \t\n"))
+			f[nf++] = p;
+		if (nf < 4 || !isdigit((unsigned char) *f[0]) || atoi(f[0]) == 0)
+			continue;
+		while (nf < 16)
+			f[nf++] = "0";
+		if (mm->tab[h = lookup(mm, atoi(f[0]))] != NIL)
+			continue;
+		if ((s = enter(mm, atoi(f[0]), f[1], h)) == NULL) {
+			(void) fclose(fp);
+			return -1;
+		}
+		s->p.size = atol(f[2]);
+		s->p.isize = atol(f[3]);
+		s->p.growth = atoi(f[4]);
+		s->p.rate = atol(f[5]);
+		s->p.faults = atol(f[6]);
+		s->p.frate = atol(f[7]);
+		s->p.hwm = atol(f[8]);
+		s->p.peak = atol(f[9]);
+		s->p.warn = atoi(f[10]);
+		s->p.threads = atol(f[11]);
+		s->p.ithreads = atol(f[12]);
+		s->p.ivsize = atol(f[13]);
+		s->p.tgrowth = atoi(f[14]);
+		/* pages:initial:growth of each NUMA node, comma separated */
+		for (k = 0, p = f[15]; p != NULL && k < MM_NODES &&
+		    sscanf(p, "%ld:%ld:%d", &s->p.numa[k], &s->p.inuma[k],
+		    &s->p.ngrowth[k]) == 3; k++)
+			if ((p = strchr(p, ',')) != NULL)
+				p++;
+		s->p.nnuma = k;
+		s->gen = mm->gen;
+	}
+	(void) fclose(fp);
+	return 0;
+}
+
+/*
+ - header - write the memmon-stats line of a cycle
+ */
+static void
+header(FILE *fp, const struct mm_counts *n, time_t last)
+{
+	(void) fprintf(fp, "PID memmon-stats seen=%ld written=%ld exited=%ld status=%ld skipped=%ld alerts=%ld dropped=%ld delayed=%ld time=%ld\n",
+	    n->seen, n->written, n->exited, n->status, n->skipped, n->alerts,
+	    n->dropped, n->delayed, (long) last);
+}
+
+/*
+ - record - write the state file line of a process
+ */
+static void
+record(FILE *fp, const struct mm_proc *p)
+{
+	int k;
+
+	(void) fprintf(fp, "%d\t%-20s\t%ld\t%ld\t%d\t%ld\t%ld\t%ld\t%ld\t%ld\t%d",
+	    p->pid, p->name, p->size, p->isize, p->growth, p->rate,
+	    p->faults < 0 ? 0 : p->faults, p->frate, p->hwm, p->peak, p->warn);
+	if (p->threads > 0 || p->nnuma > 0)
+		(void) fprintf(fp, "\t%ld\t%ld\t%ld\t%d", p->threads,
+		    p->ithreads, p->ivsize, p->tgrowth);
+	for (k = 0; k < p->nnuma; k++)
+		(void) fprintf(fp, "%c%ld:%ld:%d", k ? ',' : '\t', p->numa[k],
+		    p->inuma[k], p->ngrowth[k]);
+	(void) putc('\n', fp);
+}
+
+/*
+ - mm_save - write the records of the last cycle, in the order they were
+ - fed, with a memmon-stats line first if flags has MM_HEADER
+ */
+int
+mm_save(struct memmon *mm, const char *path, int flags)
+{
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return -1;
+	if (flags & MM_HEADER)
+		header(fp, &mm->n, mm->last);
+	for (i = 0; i < mm->norder; i++)
+		record(fp, &SLOT(mm, mm->order[i])->p);
+	if (fclose(fp) == EOF)
+		return -1;
+	return 0;
+}
+
+/*
+ - arena_alloc - n bytes that last until the next mm_begin
+ */
+static void *
+arena_alloc(struct memmon *mm, size_t n)
+{
+	void **b;
+	char *p;
+
+	n = (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	mm->aneed += n;
+	if (mm->aused + n <= mm->asize) {
+		p = mm->arena + mm->aused;
+		mm->aused += n;
+		return p;
+	}
+	if ((b = malloc(ARENA_ALIGN + n)) == NULL)
+		return NULL;
+	*b = mm->spill;
+	mm->spill = b;
+	return (char *) b + ARENA_ALIGN;
+}
+
+/*
+ - arena_reset - empty the arena, first making it as large as the last
+ - cycle needed if it ran short, or giving back most of it if that cycle
+ - needed less than a quarter, as after a fork storm
+ */
+static void
+arena_reset(struct memmon *mm)
+{
+	void *b;
+	size_t size;
+
+	while ((b = mm->spill) != NULL) {
+		mm->spill = *(void **) b;
+		free(b);
+	}
+	size = (mm->aneed + ARENA_ROUND - 1) / ARENA_ROUND * ARENA_ROUND;
+	if (size > mm->asize || size < mm->asize / 4) {
+		free(mm->arena);
+		if ((mm->arena = malloc(size)) == NULL)
+			size = 0;
+		mm->asize = size;
+	}
+	mm->aused = mm->aneed = 0;
+}
+
+/*
+ - mm_begin - start a cycle elapsed seconds after the last one
+ */
+int
+mm_begin(struct memmon *mm, long elapsed)
+{
+	mm->gen++;
+	mm->elapsed = elapsed;
+	mm->norder = 0;
+	/* the parent index starts out as large as the last one */
+	for (mm->nodehint = 1024; mm->nodehint < mm->nnodes; mm->nodehint *= 2)
+		;
+	arena_reset(mm);
+	mm->nodes = NULL;
+	mm->nnodes = mm->maxnodes = 0;
+	mm->totalled = 0;
+	mm->cut = 0;
+	(void) memset(&mm->n, 0, sizeof(mm->n));
+	return 0;
+}
+
+/*
+ - node - add a process to the parent index
+ */
+static struct node *
+node(struct memmon *mm, int pid, int ppid, long size)
+{
+	struct node *n;
+	int max;
+
+	if (mm->nnodes == mm->maxnodes) {
+		max = mm->maxnodes ? mm->maxnodes * 2 : mm->nodehint;
+		if ((n = arena_alloc(mm, max * sizeof(*n))) == NULL)
+			return NULL;
+		if (mm->nnodes > 0)
+			(void) memcpy(n, mm->nodes, mm->nnodes * sizeof(*n));
+		mm->nodes = n;
+		mm->maxnodes = max;
+	}
+	n = &mm->nodes[mm->nnodes++];
+	n->pid = pid;
+	n->ppid = ppid;
+	n->size = n->tot = size;
+	n->faults = -1;
+	n->threads = n->vsize = 0;
+	n->name[0] = '\0';
+	n->nch = 0;
+	mm->totalled = 0;
+	mm->cut = 0;
+	return n;
+}
+
+/*
+ - findnode - the index of pid in the parent index, or NIL
+ */
+static int
+findnode(struct memmon *mm, int pid)
+{
+	int i;
+
+	for (i = mm->nhash[HASH(pid, mm->maxnodes - 1)]; i != NIL;
+	    i = mm->nodes[i].next)
+		if (mm->nodes[i].pid == pid)
+			return i;
+	return NIL;
+}
+
+/*
+ - total - add every process into its parent, bottom up: one pass to
+ - count the children of each, then from the leaves, a process going to
+ - its parent once all its own children have gone into it
+ */
+static void
+total(struct memmon *mm)
+{
+	struct node *n;
+	int i, p, sp = 0;
+
+	mm->totalled = 1;
+	if (mm->nnodes == 0)
+		return;
+	if ((mm->nhash = arena_alloc(mm, mm->maxnodes * sizeof(int))) == NULL ||
+	    (mm->stack = arena_alloc(mm, mm->maxnodes * sizeof(int))) == NULL) {
+		/* without the index tree rules watch the process alone */
+		mm->nnodes = 0;
+		return;
+	}
+	for (i = 0; i < mm->maxnodes; i++)
+		mm->nhash[i] = NIL;
+	for (i = 0; i < mm->nnodes; i++) {
+		p = HASH(mm->nodes[i].pid, mm->maxnodes - 1);
+		mm->nodes[i].next = mm->nhash[p];
+		mm->nhash[p] = i;
+	}
+	for (i = 0; i < mm->nnodes; i++)
+		if ((p = findnode(mm, mm->nodes[i].ppid)) != NIL)
+			mm->nodes[p].nch++;
+	for (i = 0; i < mm->nnodes; i++)
+		if (mm->nodes[i].nch == 0)
+			mm->stack[sp++] = i;
+	while (sp > 0) {
+		n = &mm->nodes[mm->stack[--sp]];
+		if ((p = findnode(mm, n->ppid)) != NIL) {
+			mm->nodes[p].tot += n->tot;
+			if (--mm->nodes[p].nch == 0)
+				mm->stack[sp++] = p;
+		}
+	}
+}
+
+/*
+ - cut - the size of the limit'th largest process of the cycle, which
+ - the processes to be tracked must reach; 0 if there are no more than
+ - limit of them
+ */
+static void
+cut(struct memmon *mm)
+{
+	long *v, x, t;
+	int i, j, k, lo, hi;
+
+	mm->cut = 1;
+	mm->cutoff = 0;
+	if (mm->nnodes <= mm->limit ||
+	    (v = arena_alloc(mm, mm->nnodes * sizeof(long))) == NULL)
+		return;
+	for (i = 0; i < mm->nnodes; i++)
+		v[i] = mm->nodes[i].size;
+	/* quickselect, largest first */
+	k = mm->limit - 1;
+	lo = 0;
+	hi = mm->nnodes - 1;
+	while (lo < hi) {
+		x = v[(lo + hi) / 2];
+		for (i = lo, j = hi; i <= j; i++, j--) {
+			while (v[i] > x)
+				i++;
+			while (v[j] < x)
+				j--;
+			if (i > j)
+				break;
+			t = v[i];
+			v[i] = v[j];
+			v[j] = t;
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+	mm->cutoff = v[k];
+}
+
+/*
+ - mm_link - enter a process of this cycle and its parent in the parent
+ - index; with tree rules in the filter or a limit every record of the
+ - cycle must be linked before the first is fed
+ */
+int
+mm_link(struct memmon *mm, int pid, int ppid, long size)
+{
+	return node(mm, pid, ppid, size) == NULL ? -1 : 0;
+}
+
+/*
+ - mm_gone - forget a process known to have exited, so that a new one
+ - with its pid is not taken for it
+ */
+int
+mm_gone(struct memmon *mm, int pid)
+{
+	int h = lookup(mm, pid);
+
+	if (mm->tab[h] != NIL)
+		drop(mm, h);
+	return 0;
+}
+
+/*
+ - mm_threads - the task count and kB of address space of the process
+ - fed next; only a process of a threads rule keeps them
+ */
+int
+mm_threads(struct memmon *mm, long threads, long vsize)
+{
+	mm->th = threads;
+	mm->vs = vsize;
+	return 0;
+}
+
+/*
+ - alert - format an alert and hand it to the callback
+ */
+static void
+alert(struct memmon *mm, struct slot *s, int kind, const char *fmt, ...)
+{
+	struct rule *r = s->rule ? &mm->rules[s->rule - 1] : NULL;
+	struct mm_alert a;
+	va_list ap;
+
+	mm->n.alerts++;
+	if (mm->alert == NULL)
+		return;
+	va_start(ap, fmt);
+	(void) vsnprintf(mm->msg, MSGSZ, fmt, ap);
+	va_end(ap);
+	a.kind = kind;
+	a.priority = r && r->p >= 0 ? r->p : mm->priority;
+	a.category = r && r->c ? r->c : mm->category;
+	a.proc = &s->p;
+	a.message = mm->msg;
+	(*mm->alert)(&a, mm->arg);
+}
+
+/*
+ - marks - read the high-water marks of pid into *hwm and *peak
+ */
+static int
+marks(struct memmon *mm, int pid, long *hwm, long *peak)
+{
+	char path[32], *p;
+	int fd, n;
+
+	mm->n.status++;
+	*hwm = *peak = 0;
+	(void) sprintf(path, "/proc/%d/status", pid);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	n = read(fd, mm->status, STATUSSZ - 1);
+	(void) close(fd);
+	if (n <= 0)
+		return 0;
+	mm->status[n] = '\0';
+	if ((p = strstr(mm->status, "\nVmPeak:")) != NULL)
+		*peak = atol(p + 8);
+	if ((p = strstr(mm->status, "\nVmHWM:")) != NULL)
+		*hwm = atol(p + 7);
+	return *hwm > 0;
+}
+
+/*
+ - nodeline - add the N<k>= pages of a line of numa_maps or numa_stat to
+ - v; 1 if it is a line merge_cycle counts
+ */
+static int
+nodeline(struct memmon *mm, char *line, int group, int v1, long *v)
+{
+	char *x, *e;
+	long scale = 1;
+	int k;
+
+	if (group && (v1 ? strncmp(line, "total=", 6) != 0 :
+	    strncmp(line, "anon ", 5) != 0 && strncmp(line, "file ", 5) != 0))
+		return 0;
+	/* numa_maps counts pages of kernelpagesize_kB */
+	if ((x = strstr(line, " kernelpagesize_kB=")) != NULL)
+		scale = atol(x + 19) * 1024 / mm->pagesize;
+	for (x = line; (x = strstr(x, " N")) != NULL; x++)
+		if (isdigit((unsigned char) x[2])) {
+			k = (int) strtol(x + 2, &e, 10);
+			if (*e == '=' && k < mm->numa)
+				v[k] += atol(e + 1) * scale;
+		}
+	return 1;
+}
+
+/*
+ - nodes - the pages of pid on each NUMA node into v, from numa_maps, or
+ - for a group from the memory.numa_stat of its cgroup: total= in pages
+ - with cgroup v1, anon and file in bytes with v2; 0 if there was
+ - nothing to read
+ */
+static int
+nodes(struct memmon *mm, int pid, int group, long *v)
+{
+	char path[BUFSZ + 64], cg[BUFSZ], *line, *e, *x;
+	int fd, n, k, len, v1 = 0, found = 0;
+
+	for (k = 0; k < mm->numa; k++)
+		v[k] = 0;
+	if (group) {
+		(void) sprintf(path, "/proc/%d/cgroup", pid);
+		if (readfile(path, mm->status) < 0)
+			return 0;
+		/* hierarchy:controllers:path, the memory one or v2's */
+		cg[0] = '\0';
+		for (line = mm->status; (e = strchr(line, '\n')) != NULL;
+		    line = e + 1) {
+			*e = '\0';
+			if ((x = strchr(line, ':')) == NULL ||
+			    strchr(x + 1, ':') == NULL)
+				continue;
+			*strchr(x + 1, ':') = '\0';
+			if (strcmp(x + 1, "memory") == 0 ||
+			    strncmp(x + 1, "memory,", 7) == 0 ||
+			    strstr(x + 1, ",memory,") != NULL ||
+			    ((n = strlen(x + 1)) > 7 &&
+			    strcmp(x + 1 + n - 7, ",memory") == 0)) {
+				(void) snprintf(cg, BUFSZ, "%s", x + strlen(x) + 1);
+				v1 = 1;
+			} else if (strcmp(line, "0:") == 0 && x[1] == '\0' && !v1)
+				(void) snprintf(cg, BUFSZ, "%s", x + 2);
+		}
+		if (cg[0] == '\0')
+			return 0;
+		(void) sprintf(path, "%s%s/memory.numa_stat",
+		    v1 ? "/sys/fs/cgroup/memory" : "/sys/fs/cgroup", cg);
+	} else
+		(void) sprintf(path, "/proc/%d/numa_maps", pid);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	/* numa_maps has a line a mapping: read it in buffers of lines */
+	len = 0;
+	while ((n = read(fd, mm->status + len, STATUSSZ - 1 - len)) > 0) {
+		len += n;
+		mm->status[len] = '\0';
+		for (line = mm->status; (e = strchr(line, '\n')) != NULL;
+		    line = e + 1) {
+			*e = '\0';
+			found |= nodeline(mm, line, group, v1, v);
+		}
+		len -= line - mm->status;
+		(void) memmove(mm->status, line, len);
+		if (len == STATUSSZ - 1)
+			len = 0;
+	}
+	(void) close(fd);
+	if (len > 0) {
+		mm->status[len] = '\0';
+		found |= nodeline(mm, mm->status, group, v1, v);
+	}
+	if (group && !v1)
+		for (k = 0; k < mm->numa; k++)
+			v[k] /= mm->pagesize;
+	return found;
+}
+
+/*
+ - nodefree - the kB free on NUMA node n
+ */
+static long
+nodefree(int n)
+{
+	char path[48], buf[BUFSZ], *p;
+
+	(void) sprintf(path, "/sys/devices/system/node/node%d/meminfo", n);
+	if (readfile(path, buf) < 0 || (p = strstr(buf, "MemFree:")) == NULL)
+		return 0;
+	return atol(p + 8);
+}
+
+/*
+ - numa - the pages of a process of a numa rule on each node, each node
+ - with a growth count of its own, as in merge_cycle
+ */
+static void
+numa(struct memmon *mm, struct slot *s, struct rule *r, const char *what)
+{
+	struct mm_proc *p = &s->p;
+	long v[MM_NODES], old;
+	int k, no = p->nnuma, rg = r->g >= 0 ? r->g : mm->growth;
+
+	p->nnuma = 0;
+	if (!nodes(mm, p->pid, r->tree, v))
+		return;
+	p->nnuma = mm->numa;
+	for (k = 0; k < mm->numa; k++) {
+		old = p->numa[k];
+		p->numa[k] = v[k];
+		if (k >= no) {
+			p->inuma[k] = v[k];
+			p->ngrowth[k] = 0;
+		} else if (v[k] >= old + r->rate) {
+			if (++p->ngrowth[k] >= rg && v[k] - p->inuma[k] >= r->min)
+				alert(mm, s, MM_NUMA, "%s <%d %s> has grown on NUMA node %d %d times, from %ld pages to %ld pages, with %ld kB of the node free; a possible memory leak",
+				    what, p->pid, s->name, k, p->ngrowth[k],
+				    p->inuma[k], v[k], nodefree(k));
+		} else if (v[k] < old)
+			p->ngrowth[k] = 0;
+	}
+}
+
+/*
+ - mm_feed - run one record of this cycle through the detector; faults
+ - is -1 if the collector does not know them
+ */
+int
+mm_feed(struct memmon *mm, int pid, const char *name, long size, long isize,
+    long faults)
+{
+	struct slot *s;
+	struct rule *r;
+	struct mm_proc *p;
+	int h, g, rg, up, mark, ew, i;
+	long rrate, old, fh = 0, fr, vh, vp, th = mm->th, vs = mm->vs;
+	char *what = "process";
+
+	mm->th = 0;
+	if (pid == 0)
+		return 0;
+	if (mm->limit > 0) {
+		if (!mm->cut)
+			cut(mm);
+		if (size < mm->cutoff) {
+			/* the smallest go untracked, and are not exits */
+			if (mm->tab[h = lookup(mm, pid)] != NIL)
+				drop(mm, h);
+			mm->n.skipped++;
+			return 0;
+		}
+	}
+	if (mm->ntree > 0 && !mm->totalled)
+		total(mm);
+	h = lookup(mm, pid);
+	s = mm->tab[h] != NIL ? SLOT(mm, mm->tab[h]) : NULL;
+	if (s != NULL && strncmp(s->name, name, NAMESZ - 1) != 0) {
+		/* the pid was reused: the process it was has exited */
+		if (s->gen == mm->gen - 1)
+			mm->n.exited++;
+		drop(mm, h);
+		h = lookup(mm, pid);
+		s = NULL;
+	}
+	r = NULL;
+	if (s == NULL) {
+		if ((s = enter(mm, pid, name, h)) == NULL)
+			return -1;
+		if (s->rule && mm->rules[s->rule - 1].ign) {
+			drop(mm, lookup(mm, pid));
+			return 0;
+		}
+		if (s->rule && mm->rules[s->rule - 1].tree && mm->nnodes > 0 &&
+		    (i = findnode(mm, pid)) != NIL)
+			size = isize = mm->nodes[i].tot;
+		s->gen = mm->gen;
+		s->p.size = size;
+		s->p.isize = isize;
+		s->p.faults = faults;
+		if (s->rule && mm->rules[s->rule - 1].threads && th > 0) {
+			s->p.threads = s->p.ithreads = th;
+			s->p.ivsize = vs;
+		}
+		if (mm->numa && s->rule && mm->rules[s->rule - 1].numa)
+			numa(mm, s, &mm->rules[s->rule - 1], what);
+		mm->order[mm->norder++] = s->index;
+		mm->n.seen++;
+		return 0;
+	}
+	if (s->rule)
+		r = &mm->rules[s->rule - 1];
+	if ((r && r->ign) || s->gen == mm->gen)
+		return 0;
+	mm->n.seen++;
+	mm->order[mm->norder++] = s->index;
+	s->gen = mm->gen;
+	p = &s->p;
+	if (r && r->tree && mm->nnodes > 0 && (i = findnode(mm, pid)) != NIL) {
+		size = mm->nodes[i].tot;
+		what = "process tree";
+	}
+	rg = r && r->g >= 0 ? r->g : mm->growth;
+	rrate = r ? r->rate : 1;
+
+	g = p->growth;
+	old = p->size;
+	p->size = size;
+	if (mm->elapsed > 0)
+		p->rate = (p->rate + (size - old) * 3600 / mm->elapsed) / 2;
+	if (size >= old + rrate) {
+		if (++g >= rg && size - p->isize >= (r ? r->min : 0)) {
+			p->growth = g;
+			alert(mm, s, MM_GROWN, "%s <%d %s> has grown %d times, from %ld pages to %ld pages, this %s has a possible memory leak",
+			    what, pid, s->name, g, p->isize, size, what);
+		}
+	} else if (size < old)
+		g = 0;
+	p->growth = g;
+
+	/* early warning, as in merge_cycle */
+	up = 0;
+	fr = p->frate;
+	if (faults >= 0 && p->faults > 0 && mm->elapsed > 0) {
+		fh = (faults - p->faults) * 3600 / mm->elapsed;
+		up = fh > 0 && 2 * fh >= fr;
+		p->frate = (fr + fh) / 2;
+	}
+	p->faults = faults;
+	mark = 0;
+	if ((up || g > 0) && marks(mm, pid, &vh, &vp)) {
+		mark = (p->hwm > 0 && vh > p->hwm) || (p->peak > 0 && vp > p->peak);
+		p->hwm = vh;
+		p->peak = vp;
+	}
+	if (up && mark)
+		p->warn++;
+	else if (!up)
+		p->warn = 0;
+	ew = r && r->w >= 0 ? r->w : (rg + 1) / 2;
+	if (ew > 0 && p->warn >= ew && g < rg)
+		alert(mm, s, MM_EARLY, "process <%d %s> is faulting in %ld pages an hour (average %ld) and set a new high-water mark of %ld kB, %d cycles running; an early sign of a memory leak",
+		    pid, s->name, fh, fr, p->hwm, p->warn);
+	if (r && r->max > 0 && size > r->max)
+		alert(mm, s, MM_CAPPED, "%s <%d %s> is %ld pages, over its limit of %ld pages",
+		    what, pid, s->name, size, r->max);
+
+	/* thread mode, as in merge_cycle */
+	if (!(r && r->threads))
+		th = 0;
+	if (th > 0 && p->threads > 0 && th >= p->threads) {
+		if (th > p->threads && ++p->tgrowth >= rg)
+			alert(mm, s, MM_THREADS, "process <%d %s> has added threads %d times, from %ld threads to %ld, each with %ld kB of address space; a possible thread leak",
+			    pid, s->name, p->tgrowth, p->ithreads, th,
+			    (vs - p->ivsize) / (th - p->ithreads));
+	} else {
+		p->tgrowth = 0;
+		p->ithreads = th;
+		p->ivsize = vs;
+	}
+	p->threads = th;
+
+	/* numa mode, as in merge_cycle */
+	if (mm->numa && r && r->numa)
+		numa(mm, s, r, what);
+	else
+		p->nnuma = 0;
+	return 0;
+}
+
+/*
+ - mm_end - finish the cycle: whatever was not fed has exited
+ */
+int
+mm_end(struct memmon *mm)
+{
+	int h;
+
+	for (h = 0; h <= mm->tmask; h++)
+		while (mm->tab[h] != NIL && SLOT(mm, mm->tab[h])->gen != mm->gen) {
+			if (SLOT(mm, mm->tab[h])->gen == mm->gen - 1)
+				mm->n.exited++;
+			drop(mm, h);
+		}
+	mm->n.written = mm->norder;
+	return 0;
+}
+
+/*
+ - readfile - read a /proc file whole into buf, NUL terminated
+ */
+static int
+readfile(const char *path, char *buf)
+{
+	int fd, n;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	n = read(fd, buf, BUFSZ - 1);
+	(void) close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+/*
+ - tasks - count the entries of /proc/<pid>/task, or -1
+ */
+static long
+tasks(char *dents, int pid)
+{
+	char path[32];
+	int fd, n, off;
+	unsigned short reclen;
+	long count = 0;
+
+	(void) sprintf(path, "/proc/%d/task", pid);
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0)
+		return -1;
+	while ((n = syscall(SYS_getdents64, fd, dents, DENTSZ)) > 0)
+		for (off = 0; off < n; off += reclen) {
+			(void) memcpy(&reclen, dents + off + 16, sizeof(reclen));
+			if (isdigit((unsigned char) dents[off + 19]))
+				count++;
+		}
+	(void) close(fd);
+	return count;
+}
+
+/*
+ - collect - read every process in /proc into b, through the buffers of
+ - rd rather than opendir, then walk the tasks of those with threads
+ - rules until the budget is spent.  It only reads the handle, so that
+ - the collector of mm_run can run beside the detector.
+ */
+static int
+collect(struct memmon *mm, struct batch *b, struct reader *rd)
+{
+	struct pstat ps;
+	struct node *np;
+	char path[48], *name;
+	int dfd, n, off, i, max, want = PS_FAULTS | PS_PPID;
+	unsigned short reclen;
+	long left = mm->budget, th;
+
+	b->nrecs = 0;
+	b->now = time(NULL);
+	if (mm->nthreaded > 0)
+		want |= PS_THREADS | PS_VSIZE;
+	if ((dfd = open("/proc", O_RDONLY | O_DIRECTORY)) < 0)
+		return -1;
+	while ((n = syscall(SYS_getdents64, dfd, rd->dents, DENTSZ)) > 0)
+		for (off = 0; off < n; off += reclen) {
+			/* struct linux_dirent64: ino, off, reclen, type, name */
+			(void) memcpy(&reclen, rd->dents + off + 16, sizeof(reclen));
+			name = rd->dents + off + 19;
+			if (!isdigit((unsigned char) *name))
+				continue;
+			(void) sprintf(path, "/proc/%d/stat", atoi(name));
+			if (readfile(path, rd->stat) < 0)
+				continue;
+			(void) strcat(path, "m");
+			if (readfile(path, rd->statm) < 0 || procstat(rd->stat,
+			    rd->statm, &ps, want) < 0)
+				continue;
+			if (b->nrecs == b->maxrecs) {
+				max = b->maxrecs ? b->maxrecs * 2 : 1024;
+				if ((np = realloc(b->recs, max * sizeof(*np))) == NULL) {
+					(void) close(dfd);
+					return -1;
+				}
+				b->recs = np;
+				b->maxrecs = max;
+			}
+			np = &b->recs[b->nrecs++];
+			np->pid = atoi(name);
+			np->ppid = ps.ppid;
+			np->size = np->tot = ps.size;
+			np->faults = ps.minflt + ps.majflt;
+			np->threads = np->vsize = 0;
+			if (mm->nthreaded > 0) {
+				np->threads = ps.threads;
+				np->vsize = ps.vsize / 1024;
+			}
+			np->nch = 0;
+			(void) snprintf(np->name, NAMESZ, "%s", ps.comm);
+		}
+	(void) close(dfd);
+	for (i = 0; i < b->nrecs; i++) {
+		np = &b->recs[i];
+		if (np->threads == 0)
+			continue;
+		if ((n = policy(mm, np->name)) == 0 || !mm->rules[n - 1].threads)
+			np->threads = 0;
+		else if (left > 0 && (th = tasks(rd->dents, np->pid)) > 0) {
+			left -= th;
+			np->threads = th;
+		}
+	}
+	return 0;
+}
+
+/*
+ - detect - run the cycle collected into b through the detector, with
+ - its records as the parent index
+ */
+static int
+detect(struct memmon *mm, struct batch *b)
+{
+	struct node *np;
+	int i;
+
+	mm_begin(mm, mm->last > 0 ? b->now - mm->last : 0);
+	mm->last = b->now;
+	mm->nodes = b->recs;
+	mm->nnodes = b->nrecs;
+	mm->maxnodes = b->maxrecs;
+	for (i = 0; i < mm->nnodes; i++) {
+		np = &mm->nodes[i];
+		if (np->threads > 0)
+			(void) mm_threads(mm, np->threads, np->vsize);
+		if (mm_feed(mm, np->pid, np->name, np->size, np->size,
+		    np->faults) < 0)
+			return -1;
+	}
+	return mm_end(mm);
+}
+
+/*
+ - mm_sample - run a cycle over every process in /proc: read them all
+ - into the batch of the handle, which once it has room for them all
+ - allocates nothing, and feed them to the detector
+ */
+int
+mm_sample(struct memmon *mm)
+{
+	if (collect(mm, &mm->own, &mm->rd) < 0)
+		return -1;
+	return detect(mm, &mm->own);
+}
+
+/*
+ - push - hand b, or NULL for the end, to the consumer of r
+ */
+static void
+push(struct ring *r, struct batch *b)
+{
+	unsigned int h = r->head;
+
+	r->b[h % NRING] = b;
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+	(void) syscall(SYS_futex, &r->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ - pop - take the next batch from r, waiting for one if wait is set;
+ - NULL at the end mark, or when there is none to take
+ */
+static struct batch *
+pop(struct ring *r, int wait)
+{
+	struct batch *b;
+	unsigned int h, t = r->tail;
+
+	while ((h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == t) {
+		if (!wait)
+			return NULL;
+		(void) syscall(SYS_futex, &r->head, FUTEX_WAIT_PRIVATE, h, NULL,
+		    NULL, 0);
+	}
+	b = r->b[t % NRING];
+	__atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+	return b;
+}
+
+/*
+ - stop - stop the stages of pl for err, unless one already has
+ */
+static void
+stop(struct pipeline *pl, int err)
+{
+	int none = 0;
+
+	(void) __atomic_compare_exchange_n(&pl->stop, &none, err ? err : EIO,
+	    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ - collector - every interval, read /proc into a batch back from the
+ - sink, or count the cycle dropped if they are all still downstream
+ */
+static void *
+collector(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct batch *b;
+	struct timespec next;
+	long cycle, dropped = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (cycle = 1; pl->cycles == 0 || cycle <= pl->cycles; cycle++) {
+		if (cycle > 1) {
+			next.tv_sec += pl->interval;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			    &next, NULL) == EINTR)
+				;
+		}
+		if (__atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE))
+			break;
+		if ((b = pop(&pl->free, 0)) == NULL) {
+			dropped++;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &b->at);
+		b->dropped = dropped;
+		dropped = 0;
+		if (collect(pl->mm, b, &pl->rd) < 0) {
+			/* b stays here: only the sink hands batches back */
+			stop(pl, errno);
+			break;
+		}
+		push(&pl->full, b);
+	}
+	push(&pl->full, NULL);
+	return NULL;
+}
+
+/*
+ - queue - the alert callback of the detector under mm_run: a copy of
+ - the alert goes into the batch for the sink
+ */
+static void
+queue(const struct mm_alert *a, void *arg)
+{
+	struct batch *b = arg;
+	struct qalert *q;
+	int max;
+
+	if (b->nalerts == b->maxalerts) {
+		max = b->maxalerts ? b->maxalerts * 2 : 16;
+		if ((q = realloc(b->alerts, max * sizeof(*q))) == NULL)
+			return;
+		b->alerts = q;
+		b->maxalerts = max;
+	}
+	q = &b->alerts[b->nalerts++];
+	q->a = *a;
+	q->p = *a->proc;
+	(void) snprintf(q->name, NAMESZ, "%s", a->proc->name);
+	(void) snprintf(q->msg, MSGSZ, "%s", a->message);
+}
+
+/*
+ - keep - copy the records and counts the detector left into b, for the
+ - sink to save
+ */
+static int
+keep(struct memmon *mm, struct batch *b)
+{
+	struct slot *s;
+	int i, max;
+
+	if (mm->norder > b->maxstate) {
+		for (max = b->maxstate ? b->maxstate : 1024; max < mm->norder; )
+			max *= 2;
+		if ((s = realloc(b->state, max * sizeof(*s))) == NULL)
+			return -1;
+		b->state = s;
+		b->maxstate = max;
+	}
+	for (i = 0; i < mm->norder; i++)
+		b->state[i] = *SLOT(mm, mm->order[i]);
+	b->nstate = mm->norder;
+	b->n = mm->n;
+	b->last = mm->last;
+	return 0;
+}
+
+/*
+ - sink - hand the alerts of each batch to the callback and rewrite the
+ - state file, then give the batch back to the collector
+ */
+static void *
+sink(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct batch *b;
+	struct qalert *q;
+	struct timespec now;
+	FILE *fp;
+	int i;
+
+	while ((b = pop(&pl->done, 1)) != NULL) {
+		if (__atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE)) {
+			push(&pl->free, b);
+			continue;
+		}
+		for (i = 0; i < b->nalerts; i++) {
+			q = &b->alerts[i];
+			q->p.name = q->name;
+			q->a.proc = &q->p;
+			q->a.message = q->msg;
+			if (pl->fn != NULL)
+				(*pl->fn)(&q->a, pl->arg);
+		}
+		if (pl->path != NULL) {
+			if ((fp = fopen(pl->path, "w")) == NULL) {
+				stop(pl, errno);
+				push(&pl->free, b);
+				continue;
+			}
+			/* late by the time it can be written */
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			b->n.dropped = b->dropped;
+			b->n.delayed = now.tv_sec - b->at.tv_sec > pl->interval;
+			header(fp, &b->n, b->last);
+			for (i = 0; i < b->nstate; i++) {
+				b->state[i].p.name = b->state[i].name;
+				record(fp, &b->state[i].p);
+			}
+			if (fclose(fp) == EOF)
+				stop(pl, errno);
+		}
+		push(&pl->free, b);
+	}
+	return NULL;
+}
+
+/*
+ - mm_run - sample every interval seconds, cycles times or for ever if
+ - 0, with the collector, the detector and the sink on threads of their
+ - own.  The alerts go to the callback of mm_alerts on the sink thread,
+ - and path, unless NULL, is rewritten after each cycle as by mm_save
+ - with MM_HEADER; its dropped= counts the cycles skipped just before
+ - for want of a batch, and delayed= is 1 if it was written more than an
+ - interval after the scan.
+ */
+int
+mm_run(struct memmon *mm, long interval, long cycles, const char *path)
+{
+	struct pipeline *pl;
+	struct batch *b;
+	pthread_t ct, st;
+	int i, err;
+
+	if (interval < 1 || cycles < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((pl = calloc(1, sizeof(*pl))) == NULL)
+		return -1;
+	pl->mm = mm;
+	pl->interval = interval;
+	pl->cycles = cycles;
+	pl->path = path;
+	pl->fn = mm->alert;
+	pl->arg = mm->arg;
+	for (i = 0; i < NBATCH; i++)
+		push(&pl->free, &pl->batch[i]);
+	if ((err = pthread_create(&st, NULL, sink, pl)) != 0) {
+		free(pl);
+		errno = err;
+		return -1;
+	}
+	if ((err = pthread_create(&ct, NULL, collector, pl)) != 0)
+		stop(pl, err);
+	else {
+		/* the detector is this thread */
+		mm->alert = queue;
+		while ((b = pop(&pl->full, 1)) != NULL) {
+			b->nalerts = 0;
+			mm->arg = b;
+			if (!__atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE) &&
+			    (detect(mm, b) < 0 || keep(mm, b) < 0))
+				stop(pl, errno);
+			push(&pl->done, b);
+		}
+		(void) pthread_join(ct, NULL);
+		/* the parent index was the last batch */
+		mm->nodes = NULL;
+		mm->nnodes = mm->maxnodes = 0;
+		mm->alert = pl->fn;
+		mm->arg = pl->arg;
+	}
+	push(&pl->done, NULL);
+	(void) pthread_join(st, NULL);
+	for (i = 0; i < NBATCH; i++) {
+		free(pl->batch[i].recs);
+		free(pl->batch[i].alerts);
+		free(pl->batch[i].state);
+	}
+	err = pl->stop;
+	free(pl);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ - mm_next - the next process of the last cycle that is growing, from
+ - *cursor, which starts at 0; NULL after the last
+ */
+const struct mm_proc *
+mm_next(struct memmon *mm, int *cursor)
+{
+	struct mm_proc *p;
+	int i;
+
+	while (*cursor < mm->norder) {
+		i = mm->order[(*cursor)++];
+		p = &SLOT(mm, i)->p;
+		if (p->growth > 0)
+			return p;
+	}
+	return NULL;
+}
+
+/*
+ - mm_counts - the counts of the last cycle
+ */
+const struct mm_counts *
+mm_counts(struct memmon *mm)
+{
+	return &mm->n;
+}
@@ -0,0 +1,246 @@
+/*
+ * memmerge [-c category] [-e elapsed] [-f filter] [-g growth] [-n limit]
+ *	[-p priority] [-x exited] state current newstate alerts -
+ * merge_cycle of memmon on libmemmon: join the records in current to
+ * state, write the new records to newstate and the alerts, as lines of
+ * "pid size rate priority category message", to alerts, and print
+ * "seen alerts exited status skipped suspects"; memmerge -b cycles
+ * [-n limit] runs that many cycles of a host with fork storms and
+ * reports the memory of the handle as they go.  memmerge -i interval
+ * state alerts is a daemon that samples /proc itself, appending the
+ * alerts and rewriting state with its memmon-stats line every cycle;
+ * the scans keep their interval however slow the writes.
+ */
+char ident[] = "@(#) memmerge.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "memmon.h"
+
+#define	BUFSZ	1024
+#define	SERVICES	200	/* long-lived processes of the benchmark */
+#define	STORM		50000	/* short-lived ones, every STORMS cycles */
+#define	STORMS		1000
+
+char *progname;
+
+static void
+write_alert(const struct mm_alert *a, void *arg)
+{
+	(void) fprintf((FILE *) arg, "%d %ld %ld %d %s %s\n", a->proc->pid,
+	    a->proc->size, a->proc->rate, a->priority, a->category, a->message);
+}
+
+static void
+fail(char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+/*
+ - rss - VmRSS of this process in kB, and VmHWM into *hwm
+ */
+static long
+rss(long *hwm)
+{
+	FILE *fp;
+	char line[BUFSZ];
+	long kb = 0;
+
+	if ((fp = fopen("/proc/self/status", "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "VmRSS:", 6) == 0)
+			kb = atol(line + 6);
+		else if (strncmp(line, "VmHWM:", 6) == 0)
+			*hwm = atol(line + 6);
+	(void) fclose(fp);
+	return kb;
+}
+
+/*
+ - benchmark - feed mm cycles of SERVICES processes that grow now and
+ - then, with a storm of STORM new ones every STORMS cycles, printing the
+ - RSS of memmerge at every power of ten; it should stay flat once the
+ - first storm has sized the tables
+ */
+static void
+benchmark(struct memmon *mm, long cycles)
+{
+	struct timespec t0, t1;
+	long c, next = 1, records = 0, skipped = 0, kb, first = 0, hwm = 0;
+	int i, n, pid, storm = 1000000;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (c = 1; c <= cycles; c++) {
+		(void) mm_begin(mm, 600);
+		n = SERVICES + (c % STORMS == 0 ? STORM : 0);
+		for (i = 0; i < n; i++) {
+			pid = i < SERVICES ? 1000 + i : storm + i;
+			if (mm_link(mm, pid, i < SERVICES ? 1 : 1000, i < SERVICES ?
+			    1000 + pid % 5000 + c / 100 % 7 : 100 + i % 50) < 0)
+				fail(progname);
+		}
+		for (i = 0; i < n; i++) {
+			pid = i < SERVICES ? 1000 + i : storm + i;
+			if (mm_feed(mm, pid, i < SERVICES ? "service" : "storm",
+			    i < SERVICES ? 1000 + pid % 5000 + c / 100 % 7 :
+			    100 + i % 50, 1000, c * 10) < 0)
+				fail(progname);
+		}
+		(void) mm_end(mm);
+		if (n > SERVICES)
+			storm += STORM;
+		records += n;
+		skipped += mm_counts(mm)->skipped;
+		if (c == next || c == cycles) {
+			kb = rss(&hwm);
+			if (first == 0)
+				first = kb;
+			(void) printf("cycle %ld: rss %ld kB\n", c, kb);
+			next *= 10;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+	    (records ? records : 1);
+	(void) printf("%ld cycles, %ld records, %.0f ns a record, %ld skipped; rss %ld kB to %ld kB, high-water %ld kB\n",
+	    cycles, records, ns, skipped, first, rss(&hwm), hwm);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct memmon *mm;
+	const struct mm_proc *p;
+	const struct mm_counts *n;
+	FILE *fp, *alerts;
+	char line[BUFSZ], *f[9], *s, *gone = NULL;
+	long elapsed = 0, bench = 0, interval = 0;
+	int c, nf, cursor, pass, errflg = 0;
+
+	progname = argv[0];
+	if ((mm = mm_open()) == NULL)
+		fail(progname);
+	while ((c = getopt(argc, argv, "b:c:e:f:g:i:n:p:x:")) != EOF)
+		switch (c) {
+		case 'b':
+			bench = atol(optarg);
+			break;
+		case 'c':
+			if (mm_set(mm, "category", optarg) < 0)
+				errflg++;
+			break;
+		case 'e':
+			elapsed = atol(optarg);
+			break;
+		case 'f':
+			/* memmon goes on without a filter file too */
+			(void) mm_set(mm, "filter", optarg);
+			break;
+		case 'g':
+			if (mm_set(mm, "growth", optarg) < 0)
+				errflg++;
+			break;
+		case 'i':
+			interval = atol(optarg);
+			break;
+		case 'n':
+			if (mm_set(mm, "limit", optarg) < 0)
+				errflg++;
+			break;
+		case 'p':
+			if (mm_set(mm, "priority", optarg) < 0)
+				errflg++;
+			break;
+		case 'x':
+			gone = optarg;
+			break;
+		case '?':
+		default:
+			errflg++;
+			break;
+		}
+	if (bench > 0 && !errflg && argc == optind) {
+		benchmark(mm, bench);
+		exit(0);
+	}
+	if (interval > 0 && !errflg && argc - optind == 2) {
+		/* a state file is only missing on the first run */
+		if (mm_load(mm, argv[optind]) < 0 && errno != ENOENT)
+			fail(argv[optind]);
+		if ((alerts = fopen(argv[optind + 1], "a")) == NULL)
+			fail(argv[optind + 1]);
+		setvbuf(alerts, NULL, _IOLBF, BUFSIZ);
+		mm_alerts(mm, write_alert, alerts);
+		if (mm_run(mm, interval, 0, argv[optind]) < 0)
+			fail(progname);
+		exit(0);
+	}
+	if (errflg || interval != 0 || argc - optind != 4) {
+		(void) fprintf(stderr,
+		    "Usage: %s [-c category] [-e elapsed] [-f filter] [-g growth] [-n limit] [-p priority] [-x exited] state current newstate alerts\n"
+		    "       %s -i interval [-c category] [-f filter] [-g growth] [-n limit] [-p priority] state alerts\n"
+		    "       %s -b cycles [-n limit]\n", progname, progname, progname);
+		exit(2);
+	}
+	if (mm_load(mm, argv[optind]) < 0)
+		fail(argv[optind]);
+	if (gone != NULL && (fp = fopen(gone, "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (atoi(line) > 0)
+				(void) mm_gone(mm, atoi(line));
+		(void) fclose(fp);
+	}
+	if ((alerts = fopen(argv[optind + 3], "w")) == NULL)
+		fail(argv[optind + 3]);
+	mm_alerts(mm, write_alert, alerts);
+
+	if ((fp = fopen(argv[optind + 1], "r")) == NULL)
+		fail(argv[optind + 1]);
+	(void) mm_begin(mm, elapsed);
+	/* the parents first, for tree rules, then the records */
+	for (pass = 0; pass < 2; pass++) {
+		rewind(fp);
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			for (nf = 0, s = strtok(line, " \t\n"); s != NULL && nf < 9;
+			    s = strtok(NULL, " \t\n"))
+				f[nf++] = s;
+			if (nf < 4 || atoi(f[0]) <= 0)
+				continue;
+			if (pass == 0) {
+				if (nf >= 7 && mm_link(mm, atoi(f[0]), atoi(f[6]),
+				    atol(f[2])) < 0)
+					fail(progname);
+				continue;
+			}
+			/* memscan -t adds threads and address space */
+			if (nf == 9)
+				(void) mm_threads(mm, atol(f[7]), atol(f[8]));
+			if (mm_feed(mm, atoi(f[0]), f[1], atol(f[2]), atol(f[3]),
+			    nf > 5 && isdigit((unsigned char) *f[5]) ?
+			    atol(f[5]) : -1) < 0)
+				fail(progname);
+		}
+	}
+	(void) fclose(fp);
+	(void) mm_end(mm);
+	if (fclose(alerts) == EOF)
+		fail(argv[optind + 3]);
+	if (mm_save(mm, argv[optind + 2], 0) < 0)
+		fail(argv[optind + 2]);
+
+	n = mm_counts(mm);
+	(void) printf("%ld %ld %ld %ld %ld ", n->seen, n->alerts, n->exited,
+	    n->status, n->skipped);
+	for (cursor = 0; (p = mm_next(mm, &cursor)) != NULL; )
+		(void) printf("%d:%d:%ld ", p->pid, p->growth, p->isize);
+	(void) printf("\n");
+	exit(0);
+}
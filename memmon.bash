@@ -17,16 +17,150 @@
 #
 #  OPTIONS:
 #
+#  -C Spread the reads of each daemon cycle over the interval, within
+#     <percent> of one core (memscan only)
 #  -c Override default category (default - 'memmon.bash')
 #  -f Override default filter file (default - ./memfilt)
 #  -p Override default priority (default - 3)
+#  -r Replay the snapshots in a directory or tar archive instead of
+#     sampling, reporting what each growth count in -g (a comma
+#     separated list, run in parallel) would have flagged and when;
+#     the memreplay helper does this natively when it is installed
 #  -g Override default growth count (default - 10)
+#  -i Run as a daemon, sampling every <interval> seconds
+#  -k Also watch the memory the kernel holds outside the processes,
+#     alerting under <category>
+#  -m Keep the process table within <size> (K, M or G) of memory
+#  -P Evaluate the profiles in a file against one shared scan
+#  -s Report the cost of this cycle on stderr before exiting
+#  -t Arm the allocation tracker of flagged processes that run with
+#     libmemmon-track.so preloaded
+#
+#  Each cycle times its phases (scan, gauge, merge, persist) and counts
+#  the processes seen, records written, processes exited, bytes scanned
+#  and alerts raised.  These are kept as log2 histograms in
+#  /tmp/msstats_<host> and the last cycle is recorded in the PID header
+#  line of the state file.
+#
+#  The filter file holds one rule per line: a process name or shell
+#  pattern followed by optional settings that override the command line
+#  for the processes it matches (see memfilt).  A name on its own, or
+#  with 'ignore', is never flagged.
+#
+#  When the memscan helper is installed the process table is read from
+#  /proc by memscan instead of 'ps -el'.  In daemon mode memscan keeps
+#  the /proc descriptors of every process open between cycles and holds
+#  a pidfd for each, so an exit is seen as it happens: the record is
+#  dropped before the pid can be reused, and a process that had started
+#  to grow is reported with its final size.
+#
+#  Each cycle also gauges memory pressure from /proc/pressure/memory,
+#  MemAvailable and SwapFree in /proc/meminfo and the limit events in
+#  the cgroup memory.events files.  Alerts carry the pressure.  The daemon
+#  samples faster as tasks start to stall on memory, at once when memscan
+#  sees a burst of stalls, and half as often on a host with none.
+#
+#  Every record keeps a moving average of its growth in pages an hour,
+#  and each alert projects when the process will run out of room: under
+#  its cgroup memory limit, its RLIMIT_AS, or the available memory and
+#  swap of the host, where the suspects sharing a limit add up.  Alerts
+#  are listed soonest first.  Only the processes being reported have
+#  their limits read.
+#
+#  Records also keep the page faults of the process, from memscan, and
+#  the processes that are growing or faulting have their VmHWM and VmPeak
+#  read from /proc/<pid>/status.  One that keeps faulting in pages at
+#  no less than half its average rate while setting new high-water marks
+#  gets an early warning once it has done so for w= cycles running (half
+#  the growth count by default), before the growth count is reached.
+#  The status= count of each cycle is the number of these reads.
+#
+#  The collectors keep the PPID of each process.  A filter rule with
+#  'tree' watches the processes it matches by the total of their process
+#  tree, so that a prefork server or worker pool leaking through
+#  short-lived children is still seen to grow.  The totals are worked out
+#  each cycle, bottom up, from a parent index of the whole snapshot.
+#
+#  A rule with 'threads' has memscan also walk /proc/<pid>/task for the
+#  processes it matches, keeping their thread count and address space.
+#  One whose thread count grows g= times without dropping back is flagged
+#  as a possible thread leak, with the address space each new thread has
+#  brought, which is mostly its stack.  The walks share the descriptor
+#  cache of memscan and stop each cycle after a budget of task entries
+#  (memscan -T); past it the count comes from /proc/<pid>/stat.
+#
+#  On a host with more than one NUMA node a rule with 'numa' follows the
+#  pages the processes it matches have on each node, from their
+#  numa_maps, or for a 'tree' rule from the memory.numa_stat of their
+#  cgroup.  Each node has a growth count of its own, so a process that
+#  keeps growing on one node, heading for remote accesses and a node
+#  local OOM, is flagged with the node and the memory it has free while
+#  the total still looks flat.  The first 8 nodes are followed; on a
+#  single node host the rule does nothing and nothing is read.
+#
+#  A service started with LD_PRELOAD=libmemmon-track.so runs with its
+#  allocation tracker dormant.  With -t memmon signals a flagged process
+#  that has it loaded to start sampling its allocation call sites, and
+#  on each later alert asks it for a report of the stacks that allocated
+#  most since then, in $MEMMON_TRACK_DIR/memmon-track.<pid> (/tmp); the
+#  alert names the report and its top stack.  MEMMON_TRACK_SIGNAL, when
+#  set, must be the same for memmon and the service: USR1, USR2, RTMIN+n
+#  or a number.
+#
+#  With -P one run serves several policies, such as one that pages,
+#  one that files tickets and one for capacity planning.  Each line of
+#  the profiles file is a name followed by any of -c, -f, -g and -p,
+#  which override the command line for that profile, and -o, a file its
+#  alerts are appended to instead of going to stdout.  The processes are
+#  scanned and the pressure gauged once a cycle; each profile then merges
+#  the scan into a state file of its own, /tmp/psdata_<host>.<name>, with
+#  its own stats in /tmp/msstats_<host>.<name>.
+#
+#  A daemon sweeping /proc at the top of the interval competes with
+#  whatever else starts then.  With -C memscan lists the processes at the
+#  start of each cycle and reads them in small slices spread over the
+#  interval, each slice sized by what a read has been costing, and
+#  within the CPU time the percentage given allows.  When that is not
+#  enough for all of them a cycle reads as many as it can, starting where
+#  the last one stopped, and the rest keep their last record; memscan
+#  says so on stderr and coverage= records the percentage read.
+#
+#  A service restarted every night by its supervisor never grows for
+#  long under one pid.  A rule with 'lifetimes' follows the processes it
+#  matches by executable and cgroup instead, in /tmp/lfdata_<host>: each
+#  lifetime is summed up as its size at the start, an hour, six hours
+#  and a day in, its peak and its size at the end, and only the last
+#  four of them are kept.  An executable whose lifetimes end larger than
+#  they were an hour in, by min= or more, that many lifetimes running
+#  (lifetimes=3 by default) is flagged, and so is one whose size an hour
+#  in has risen by more than a tenth with a new release, a newer binary.
+#  Only these processes have their start time read each cycle, and their
+#  executable once.
+#
+#  With -k each cycle also samples the memory the kernel holds for no
+#  process in particular: every slab cache, from /proc/slabinfo or when
+#  that is not readable /sys/kernel/slab, the Shmem, PageTables and
+#  SUnreclaim lines of /proc/meminfo, the System V shared memory
+#  segments, in all and those no process has attached, and the space
+#  used on each tmpfs mount, such as /dev/shm.  These are named
+#  slab:<cache>, meminfo:<line>, sysvshm:all, sysvshm:orphaned and
+#  tmpfs:<mount>, take filter rules like processes, and go through the
+#  same growth count and projection, in a state file of their own,
+#  /tmp/ksdata_<host>; their alerts carry the category given to -k.
+#
+#  With -m the process table is held to about 1 kB a process of the
+#  size given.  A cycle that lists more processes than that, as in a
+#  fork storm, tracks the largest and skips the rest, dropping their
+#  records without counting them as exits; skipped= counts them.
+#  memmerge keeps its records in slabs and the work of a cycle in an
+#  arena reset at the next, so that its memory stays flat under the
+#  limit (memmerge -b shows it over a run of fork storms).
 #
 
 export LC_TIME="C"  #set the time locale so getdate works correctly
 
 ME=`basename $0`
-USAGE="Usage: $ME [-c category] [-f filter] [-g growth count] [-p priority]"
+USAGE="Usage: $ME [-C percent] [-c category] [-f filter] [-g growth count] [-i interval] [-k category] [-m size] [-P profiles] [-p priority] [-r snapshots] [-s] [-t]"
  
 ####################################################################
 ### This func is used to issue an error and quit; $1 is an err message
@@ -45,17 +179,1224 @@ err_use(){
 }
  
 ####################################################################
-### This func is used collect base line information
+### This func is used to read the monotonic clock in 1/100 seconds
+####################################################################
+read_clock(){
+	if [ -r /proc/uptime ]
+	then
+		read Clock Idle </proc/uptime
+		Clock=${Clock%.*}${Clock#*.}
+	else
+		Clock=`expr $SECONDS \* 100`
+	fi
+}
+
+####################################################################
+### This func is used to time a cycle phase; $1 is the phase name
+####################################################################
+end_phase(){
+	Phase_start=$Clock
+	read_clock
+	Phase_times="$Phase_times $1=`expr \( $Clock - $Phase_start \) \* 10`"
+}
+
+####################################################################
+### This func is used to fold this cycle into the stats histograms
+####################################################################
+update_stats(){
+	if [ ! -f ${ST_DATA} ]
+	then
+		>${ST_DATA}
+	fi
+	awk -v cycle="$1" -v report=$Stats -v out=${ST_DATA}1 '
+	# name count sum max b0..b32, bucket b covers [2^(b-1), 2^b) and
+	# b32 whatever is larger
+	NF > 4 {
+		n[$1] = $2; sum[$1] = $3; max[$1] = $4
+		for (b = 0; b <= 32; b++)
+			h[$1, b] = $(b + 5)
+		if (!($1 in seen)) { seen[$1] = 1; order[++nk] = $1 }
+	}
+	END {
+		nf = split(cycle, f, " ")
+		for (i = 1; i <= nf; i++) {
+			split(f[i], kv, "=")
+			k = kv[1]; v = kv[2] + 0
+			for (b = 0; b < 32 && v >= 2 ^ b; b++)
+				;
+			h[k, b]++; n[k]++; sum[k] += v
+			if (v > max[k] + 0) max[k] = v
+			if (!(k in seen)) { seen[k] = 1; order[++nk] = k }
+			last[k] = v
+		}
+		for (i = 1; i <= nk; i++) {
+			k = order[i]
+			line = k " " n[k] " " sum[k] " " max[k] + 0
+			for (b = 0; b <= 32; b++)
+				line = line " " (h[k, b] + 0)
+			print line > out
+			if (report != "yes")
+				continue
+			p50 = pct(k, 0.50); p99 = pct(k, 0.99)
+			printf("%-10s last %8d  p50 <%8d  p99 <%8d  max %8d  n %d\n",
+			    k, last[k], p50, p99, max[k], n[k])
+		}
+	}
+	# upper bound of the bucket holding the q quantile, or the largest
+	# value when that is the last bucket
+	function pct(k, q,    b, c) {
+		for (b = 0; b < 32; b++)
+			if ((c += h[k, b]) >= q * n[k])
+				return 2 ^ b
+		return max[k]
+	}' ${ST_DATA} 1>&2
+	mv ${ST_DATA}1 ${ST_DATA}
+}
+
+####################################################################
+### This func is used to gauge memory pressure; it sets Pressure to
+### idle, normal, rising or high, Pressure_limits to the cgroup limit
+### events so far, Pressure_avail to the pages of memory and swap
+### available and Pressure_ctx to a summary for the alerts
+####################################################################
+read_pressure(){
+	Pressure=`awk -v state=${Gauge_state} -v pagesize=$Pagesize '
+	BEGIN {
+		psi = psi60 = 0
+		if ((getline line < "/proc/pressure/memory") > 0) {
+			split(line, f, "[ =]")
+			psi = f[3] + 0; psi60 = f[5] + 0
+		}
+		while ((getline line < "/proc/meminfo") > 0) {
+			split(line, f, "[: ]+")
+			m[f[1]] = f[2]
+		}
+		total = m["MemTotal"] + m["SwapTotal"]
+		avail = total ? int(100 * (m["MemAvailable"] + m["SwapFree"]) / total) : 100
+		# memory.events is hierarchical, so the top level cgroups cover
+		# the host; cgroup v1 only counts the OOM kills
+		cmd = "cat /sys/fs/cgroup/*/memory.events /sys/fs/cgroup/unified/*/memory.events /sys/fs/cgroup/memory/memory.oom_control /sys/fs/cgroup/memory/*/memory.oom_control 2>/dev/null"
+		while ((cmd | getline line) > 0) {
+			split(line, f, " ")
+			if (f[1] == "max" || f[1] == "oom_kill")
+				limits += f[2]
+		}
+		close(cmd)
+		# the last cycle left its count in the state header
+		prev = limits
+		if ((getline line < state) > 0 && line ~ /^PID memmon-stats/ &&
+		    match(line, / limits=[0-9]+/))
+			prev = substr(line, RSTART + 8, RLENGTH - 8)
+		new = limits - prev
+		if (new > 0 || psi >= 10 || avail < 5)
+			level = "high"
+		else if (psi >= 1 || avail < 15)
+			level = "rising"
+		else if (psi == 0 && psi60 == 0 && avail >= 50)
+			level = "idle"
+		else
+			level = "normal"
+		printf("%s %d %d memory pressure %s: %.2f%% stalled, %d%% available, %d new cgroup limit events\n",
+		    level, limits, (m["MemAvailable"] + m["SwapFree"]) * 1024 / pagesize,
+		    level, psi, avail, new < 0 ? 0 : new)
+	}'`
+	Pressure_limits=${Pressure#* }
+	Pressure_avail=${Pressure_limits#* }
+	Pressure_ctx=${Pressure_avail#* }
+	Pressure_avail=${Pressure_avail%% *}
+	Pressure_limits=${Pressure_limits%% *}
+	Pressure=${Pressure%% *}
+}
+
+####################################################################
+### This func is used to print the alerts in ${PS_DATA}a, or $1, lines
+### of "pid size rate priority category message", soonest to run out of
+### memory first; rate is in pages an hour
+####################################################################
+project_alerts(){
+	awk -v avail=$Pressure_avail -v pagesize=$Pagesize -v ctx="$Pressure_ctx" \
+	    "$Cgroup_awk"'
+	{
+		n++
+		pid[n] = $1; size[n] = $2; pri[n] = $4; cat[n] = $5
+		msg[n] = $0
+		for (i = 0; i < 5; i++)
+			sub(/^[^ ]+ /, "", msg[n])
+		if ($1 in rate)
+			next
+		rate[$1] = $3 > 0 ? $3 : 0
+		total += rate[$1]
+		cg[$1] = cgroup($1)
+		if (cg[$1] != "")
+			cgrate[cg[$1]] += rate[$1]
+	}
+	END {
+		for (i = 1; i <= n; i++) {
+			p = pid[i]
+			eta = -1
+			if (rate[p] > 0) {
+				reach(avail, total, "the host memory and swap")
+				if (cg[p] != "")
+					reach(room[cg[p]], cgrate[cg[p]],
+					    "the memory limit of cgroup " cg[p])
+				if ((l = aslimit(p)) != "")
+					reach(l - size[i], rate[p], "its address space limit")
+			}
+			if (eta < 0)
+				printf("%d -p %s -c %s -m \"%s; %s\"\n",
+				    2 ^ 31, pri[i], cat[i], msg[i], ctx)
+			else
+				printf("%d -p %s -c %s -m \"%s; at %d pages an hour it will reach %s in %s; %s\"\n",
+				    eta, pri[i], cat[i], msg[i], rate[p], limit, span(eta), ctx)
+		}
+	}
+	# keep the nearer of eta and the time for r pages an hour to fill room
+	function reach(room, r, what,    t) {
+		if (r <= 0)
+			return
+		t = room > 0 ? int(room * 3600 / r) : 0
+		if (eta < 0 || t < eta) {
+			eta = t; limit = what
+		}
+	}
+	# the memory cgroup of a process, noting its room in pages once per
+	# cgroup; "" if it has no limit
+	function cgroup(p,    cg, max, cur) {
+		cg = memcg(p)
+		if (cg == "" || (cg in room))
+			return room[cg] == "" ? "" : cg
+		room[cg] = ""
+		if (cgv1) {
+			max = readnum(cgdir(cg) "/memory.limit_in_bytes")
+			cur = readnum(cgdir(cg) "/memory.usage_in_bytes")
+		} else {
+			max = readnum(cgdir(cg) "/memory.max")
+			cur = readnum(cgdir(cg) "/memory.current")
+		}
+		if (max == "" || max >= 2 ^ 60)
+			return ""
+		room[cg] = int((max - cur) / pagesize)
+		return cg
+	}
+	function readnum(file,    v) {
+		v = ""
+		if ((getline v < file) > 0)
+			close(file)
+		return v ~ /^[0-9]+$/ ? v : ""
+	}
+	# the RLIMIT_AS of a process in pages, or ""
+	function aslimit(p,    line, f, l) {
+		l = ""
+		while ((getline line < ("/proc/" p "/limits")) > 0)
+			if (line ~ /^Max address space/) {
+				split(line, f, " ")
+				if (f[4] ~ /^[0-9]+$/)
+					l = int(f[4] / pagesize)
+			}
+		close("/proc/" p "/limits")
+		return l
+	}
+	function span(s) {
+		if (s < 3600)
+			return int(s / 60) "m"
+		if (s < 172800)
+			return int(s / 3600) "h" int(s % 3600 / 60) "m"
+		return int(s / 86400) "d"
+	}' ${1:-${PS_DATA}a} | sort -k 1,1n | cut -d' ' -f2-
+}
+
+####################################################################
+### Awk code shared by project_alerts, merge_cycle and lifetime_cycle:
+### memcg() is the memory cgroup of a process, "" if it has none, with
+### cgv1 set for a cgroup v1 hierarchy, and cgdir() its directory
+####################################################################
+Cgroup_awk='
+	function memcg(pid,    f, line, x, cg) {
+		f = "/proc/" pid "/cgroup"
+		cg = ""; cgv1 = 0
+		while ((getline line < f) > 0) {
+			split(line, x, ":")
+			if (x[2] ~ /(^|,)memory(,|$)/) {
+				cg = x[3]; cgv1 = 1
+			} else if (x[1] == "0" && x[2] == "" && !cgv1)
+				cg = x[3]
+		}
+		close(f)
+		return cg
+	}
+	function cgdir(cg) {
+		return (cgv1 ? "/sys/fs/cgroup/memory" : "/sys/fs/cgroup") cg
+	}
+'
+
+####################################################################
+### Awk code shared by merge_cycle and replay_snapshots: compile the
+### filter file and resolve a process name to its rule with policy();
+### rule 0 holds the command line settings
+####################################################################
+Policy_awk='
+	BEGIN {
+		rg[0] = growth; rp[0] = priority; rc[0] = "-"
+		rmin[0] = 0; rrate[0] = 1; rmax[0] = 0; rw[0] = -1; rtree[0] = 0
+		rthr[0] = 0; rnuma[0] = 0; rlife[0] = 0
+		# exact names go in a hash, patterns are tried in file order
+		while ((getline line < rules) > 0) {
+			sub(/#.*/, "", line)
+			n = split(line, f, " ")
+			if (n == 0)
+				continue
+			r = ++nrules
+			ign[r] = n == 1
+			rg[r] = rg[0]; rp[r] = rp[0]; rc[r] = rc[0]
+			rmin[r] = rmin[0]; rrate[r] = rrate[0]; rmax[r] = rmax[0]
+			rw[r] = rw[0]; rtree[r] = 0; rthr[r] = 0; rnuma[r] = 0
+			rlife[r] = 0
+			for (i = 2; i <= n; i++) {
+				k = f[i]; x = ""
+				if ((e = index(k, "=")) > 0) {
+					x = substr(k, e + 1); k = substr(k, 1, e - 1)
+				}
+				if (k == "ignore") ign[r] = 1
+				else if (k == "g") rg[r] = x + 0
+				else if (k == "p") rp[r] = x + 0
+				else if (k == "c") rc[r] = x
+				else if (k == "min") rmin[r] = pages(x)
+				else if (k == "rate") rrate[r] = pages(x)
+				else if (k == "max") rmax[r] = pages(x)
+				else if (k == "w") rw[r] = x + 0
+				else if (k == "tree") { rtree[r] = 1; ntree++ }
+				else if (k == "threads") rthr[r] = 1
+				else if (k == "numa") rnuma[r] = 1
+				else if (k == "lifetimes") rlife[r] = x == "" ? 3 : x + 0
+			}
+			if (f[1] ~ /[*?[]/) {
+				pat[++npat] = glob(f[1]); patrule[npat] = r
+			} else if (!(f[1] in exact))
+				exact[f[1]] = r
+		}
+	}
+	# the rule of a process name, worked out once per name
+	function policy(name,    i) {
+		if (name in rule)
+			return rule[name]
+		rule[name] = 0
+		if (name in exact)
+			rule[name] = exact[name]
+		else
+			for (i = 1; i <= npat; i++)
+				if (name ~ pat[i]) {
+					rule[name] = patrule[i]
+					break
+				}
+		return rule[name]
+	}
+	# a size in pages, or bytes with a K, M or G suffix
+	function pages(x,    u, m) {
+		u = toupper(substr(x, length(x)))
+		m = u == "K" ? 1024 : u == "M" ? 1048576 : u == "G" ? 1073741824 : 0
+		if (m == 0)
+			return x + 0
+		return int((substr(x, 1, length(x) - 1) * m + pagesize - 1) / pagesize)
+	}
+	# an anchored regular expression for a shell pattern, read as
+	# fnmatch(3) reads it for memscan and memmerge: [!...] is a negated
+	# set, a backslash quotes the next character and a [ with no ] to
+	# close it is an ordinary character
+	function glob(p,    re, c, i, j, n) {
+		re = "^"
+		n = length(p)
+		for (i = 1; i <= n; i++) {
+			c = substr(p, i, 1)
+			if (c == "\\" && i < n)
+				c = substr(p, ++i, 1)
+			else if (c == "*") {
+				re = re ".*"; continue
+			} else if (c == "?") {
+				re = re "."; continue
+			} else if (c == "[" && (j = bracket(p, i)) > 0) {
+				re = re set(substr(p, i + 1, j - i - 1)); i = j; continue
+			}
+			re = re (index("\\.^$+(){}|/[]*?", c) ? "\\" c : c)
+		}
+		return re "$"
+	}
+	# where the set opened at i of p closes, or 0; a ] first in the set
+	# is one of its characters
+	function bracket(p, i,    c) {
+		if (index("!^", substr(p, ++i, 1)))
+			i++
+		if (substr(p, i, 1) == "]")
+			i++
+		for (; i <= length(p); i++) {
+			c = substr(p, i, 1)
+			if (c == "\\")
+				i++
+			else if (c == "]")
+				return i
+		}
+		return 0
+	}
+	# the bracket expression for the inside of a shell set
+	function set(s,    re, c, i) {
+		re = "["
+		if (index("!^", substr(s, 1, 1))) {
+			re = re "^"; s = substr(s, 2)
+		}
+		for (i = 1; i <= length(s); i++) {
+			c = substr(s, i, 1)
+			if (c == "\\" && i < length(s))
+				c = substr(s, ++i, 1)
+			re = re (index("\\]^[", c) ? "\\" c : c)
+		}
+		return re "]"
+	}
+'
+
+####################################################################
+### This func is used to join the current snapshot to the baseline;
+### both go into one hash keyed on pid, a pid whose name changed is a
+### new process, and whatever the snapshot did not renew has exited.
+### The new records go to ${PS_DATA}2 and the alerts to ${PS_DATA}a;
+### it prints "seen alerts exited status skipped suspects", status being
+### the number of /proc/<pid>/status files read for high-water marks and
+### skipped the processes below the cutoff of the -m limit.  memmerge,
+### when installed, does the same on libmemmon
+####################################################################
+merge_cycle(){
+	if [ -s ${CR_DATA}x ]
+	then
+		Gone=${CR_DATA}x
+	else
+		Gone=/dev/null
+	fi
+	if [ "$Merger" = "memmerge" ]
+	then
+		memmerge -c "$Category" -e $Elapsed -f "${Filter_file}" \
+		    -g $Growth_cnt ${Limit:+-n $Limit} -p $Priority -x $Gone \
+		    ${PS_DATA} ${CR_DATA} ${PS_DATA}2 ${PS_DATA}a
+		return
+	fi
+	# past the limit only the largest Limit processes are merged
+	Cutoff=
+	if [ -n "$Limit" ]
+	then
+		Cutoff=`awk '$1 != "PID" && $1 != 0 { print $3 }' ${CR_DATA} |
+		    sort -rn | sed -n "${Limit}p"`
+	fi
+	awk -v rules="${Filter_file}" -v pagesize=$Pagesize \
+	    -v growth=$Growth_cnt -v priority=$Priority -v category=$Category \
+	    -v cutoff=${Cutoff:-0} -v numa=$Numa \
+	    -v elapsed=$Elapsed -v state=${PS_DATA}2 -v alerts=${PS_DATA}a \
+	    -v current=${CR_DATA} "$Policy_awk$Cgroup_awk"'
+	# with tree rules each process is totalled with its descendants
+	# first: one pass for the parent and number of children of each,
+	# then up from the leaves, adding a process to its parent once all
+	# its own children have been added to it
+	BEGIN {
+		while (ntree > 0 && (getline line < current) > 0) {
+			split(line, t, " ")
+			if (t[1] != "PID" && t[1] != 0) {
+				tot[t[1]] = t[3]; par[t[1]] = t[7]
+			}
+		}
+		close(current)
+		for (p in par)
+			if (par[p] in tot)
+				nch[par[p]]++
+		for (p in tot)
+			if (!(p in nch))
+				leaf[++nl] = p
+		while (nl > 0) {
+			p = leaf[nl--]; q = par[p]
+			if (q in tot) {
+				tot[q] += tot[p]
+				if (--nch[q] == 0)
+					leaf[++nl] = q
+			}
+		}
+	}
+	$1 == "PID" || $1 == 0 { next }
+	# processes memscan saw exit since the last cycle
+	FILENAME == ARGV[1] { gone[$1]; next }
+	FILENAME == ARGV[2] {
+		if (!($1 in gone)) {
+			nm[$1] = $2; sz[$1] = $3; isz[$1] = $4; grw[$1] = $5; rt[$1] = $6 + 0
+			flt[$1] = $7 + 0; frt[$1] = $8 + 0; hwm[$1] = $9 + 0
+			peak[$1] = $10 + 0; wrn[$1] = $11 + 0
+			thr[$1] = $12 + 0; ithr[$1] = $13 + 0; ivsz[$1] = $14 + 0
+			tgr[$1] = $15 + 0; nma[$1] = $16
+		}
+		next
+	}
+	# the high-water marks of pid in kB, into vh and vp
+	function marks(pid,    f, line, x) {
+		f = "/proc/" pid "/status"
+		vh = vp = 0
+		while ((getline line < f) > 0)
+			if (line ~ /^VmHWM:/) {
+				split(line, x, " "); vh = x[2] + 0
+			} else if (line ~ /^VmPeak:/) {
+				split(line, x, " "); vp = x[2] + 0
+			}
+		close(f)
+		nstatus++
+		return vh > 0
+	}
+	# the pages of pid on each NUMA node into nd[], from numa_maps, or
+	# for a group from the memory.numa_stat of its cgroup: total= in
+	# pages with cgroup v1, anon and file in bytes with v2; 0 if there
+	# was nothing to read
+	function nodes(pid, group,    f, line, x, i, n, k, s, cg, m) {
+		for (n = 0; n < numa; n++)
+			nd[n] = 0
+		if (group) {
+			if ((cg = memcg(pid)) == "")
+				return 0
+			f = cgdir(cg) "/memory.numa_stat"
+		} else
+			f = "/proc/" pid "/numa_maps"
+		m = 0
+		while ((getline line < f) > 0) {
+			if (group && !(cgv1 ? line ~ /^total=/ : line ~ /^(anon|file) /))
+				continue
+			m = 1
+			n = split(line, x, " ")
+			# numa_maps counts pages of kernelpagesize_kB
+			s = 1
+			for (i = 1; i <= n; i++)
+				if (x[i] ~ /^kernelpagesize_kB=/)
+					s = int(substr(x[i], 19) * 1024 / pagesize)
+			for (i = 1; i <= n; i++)
+				if (x[i] ~ /^N[0-9]+=/) {
+					k = substr(x[i], 2, index(x[i], "=") - 2) + 0
+					if (k < numa)
+						nd[k] += substr(x[i], index(x[i], "=") + 1) * s
+				}
+		}
+		close(f)
+		if (group && !cgv1)
+			for (n = 0; n < numa; n++)
+				nd[n] = int(nd[n] / pagesize)
+		return m
+	}
+	# the kB free on NUMA node n
+	function nodefree(n,    f, line, x, v) {
+		f = "/sys/devices/system/node/node" n "/meminfo"
+		v = 0
+		while ((getline line < f) > 0)
+			if (line ~ /MemFree:/) {
+				split(line, x, " "); v = x[4] + 0
+			}
+		close(f)
+		return v
+	}
+	{
+		pid = $1; name = $2; size = $3; is = $4; what = "process"
+		if (size < cutoff) {
+			if (pid in nm)
+				renewed[pid] = 1
+			nskip++
+			next
+		}
+		r = policy(name)
+		if (ign[r])
+			next
+		if (rtree[r] && (pid in tot)) {
+			size = is = tot[pid]; what = "process tree"
+		}
+		nseen++
+		cat = rc[r] == "-" ? category : rc[r]
+		# memscan -t adds the tasks and kB of address space of these
+		th = rthr[r] && NF >= 9 ? $8 + 0 : 0; vs = $9 + 0
+		tg = 0; it = th; iv = vs
+		if ((pid in nm) && nm[pid] == name) {
+			renewed[pid] = 1
+			is = isz[pid]; g = grw[pid]; rate = rt[pid]
+			if (elapsed > 0)
+				rate = int((rate + int((size - sz[pid]) * 3600 / elapsed)) / 2)
+			if (size >= sz[pid] + rrate[r]) {
+				if (++g >= rg[r] && size - is >= rmin[r]) {
+					nalert++
+					printf("%s %d %d %s %s %s <%s %s> has grown %d times, from %d pages to %d pages, this %s has a possible memory leak\n",
+					    pid, size, rate, rp[r], cat, what, pid, name, g, is, size, what) > alerts
+				}
+			} else if (size < sz[pid])
+				g = 0
+
+			# early warning: still faulting in pages at no less than half
+			# its average rate while setting new high-water marks
+			up = 0; fr = frt[pid]; hw = hwm[pid]; pk = peak[pid]; w = wrn[pid]
+			if ($6 ~ /^[0-9]/ && flt[pid] > 0 && elapsed > 0) {
+				fh = int(($6 - flt[pid]) * 3600 / elapsed)
+				up = fh > 0 && 2 * fh >= fr
+				fr = int((fr + fh) / 2)
+			}
+			mark = 0
+			if ((up || g > 0) && marks(pid)) {
+				mark = (hw > 0 && vh > hw) || (pk > 0 && vp > pk)
+				hw = vh; pk = vp
+			}
+			if (up && mark)
+				w++
+			else if (!up)
+				w = 0
+			ew = rw[r] < 0 ? int((rg[r] + 1) / 2) : rw[r]
+			if (ew > 0 && w >= ew && g < rg[r]) {
+				nalert++
+				printf("%s %d %d %s %s process <%s %s> is faulting in %d pages an hour (average %d) and set a new high-water mark of %d kB, %d cycles running; an early sign of a memory leak\n",
+				    pid, size, rate, rp[r], cat, pid, name, fh, frt[pid], hw, w) > alerts
+			}
+			if (g > 0)
+				suspects = suspects pid ":" g ":" is " "
+			if (rmax[r] > 0 && size > rmax[r]) {
+				nalert++
+				printf("%s %d %d %s %s %s <%s %s> is %d pages, over its limit of %d pages\n",
+				    pid, size, rate, rp[r], cat, what, pid, name, size, rmax[r]) > alerts
+			}
+
+			# thread mode: a process that keeps adding threads, and
+			# the address space each one has brought, mostly stack
+			if (th > 0 && thr[pid] > 0 && th >= thr[pid]) {
+				tg = tgr[pid]; it = ithr[pid]; iv = ivsz[pid]
+				if (th > thr[pid] && ++tg >= rg[r]) {
+					nalert++
+					printf("%s %d %d %s %s process <%s %s> has added threads %d times, from %d threads to %d, each with %d kB of address space; a possible thread leak\n",
+					    pid, size, rate, rp[r], cat, pid, name, tg, it, th, int((vs - iv) / (th - it))) > alerts
+				}
+			}
+		} else {
+			g = 0; rate = 0; fr = 0; hw = 0; pk = 0; w = 0
+		}
+
+		# numa mode: the pages on each node, each node with a growth
+		# count of its own, kept as "pages:initial:growth,..."
+		nn = ""
+		if (numa > 0 && rnuma[r] && nodes(pid, rtree[r])) {
+			no = (pid in renewed) ? split(nma[pid], o, ",") : 0
+			for (n = 0; n < numa; n++) {
+				np = nd[n]; ni = np; ng = 0
+				if (n < no) {
+					split(o[n + 1], nv, ":")
+					ni = nv[2] + 0; ng = nv[3] + 0
+					if (np >= nv[1] + rrate[r]) {
+						if (++ng >= rg[r] && np - ni >= rmin[r]) {
+							nalert++
+							printf("%s %d %d %s %s %s <%s %s> has grown on NUMA node %d %d times, from %d pages to %d pages, with %d kB of the node free; a possible memory leak\n",
+							    pid, size, rate, rp[r], cat, what, pid, name, n, ng, ni, np, nodefree(n)) > alerts
+						}
+					} else if (np < nv[1])
+						ng = 0
+				}
+				nn = nn (n ? "," : "") np ":" ni ":" ng
+			}
+		}
+		printf("%s\t%-20s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d", pid, name, size, is,
+		    g, rate, $6, fr, hw, pk, w) > state
+		if (th > 0 || nn != "")
+			printf("\t%d\t%d\t%d\t%d", th, it, iv, tg) > state
+		if (nn != "")
+			printf("\t%s", nn) > state
+		printf("\n") > state
+	}
+	END {
+		for (pid in nm)
+			if (!(pid in renewed))
+				nexit++
+		printf("%d %d %d %d %d %s\n", nseen, nalert, nexit, nstatus,
+		    nskip, suspects)
+	}' $Gone ${PS_DATA} ${CR_DATA}
+}
+
+####################################################################
+### This func is used to follow the lifetimes of the processes of
+### 'lifetimes' rules in ${CR_DATA} by their executable and cgroup.
+### ${LF_DATA} holds a line for each process, "L pid starttime key
+### release name start 1h 6h 24h peak last", and one for each
+### executable, "E key release lives grown base nbase pbase last ended",
+### where release is the mtime of the binary, base and nbase add up the
+### sizes an hour in of its release, pbase is the mean of the release
+### before and ended the last LIVES lifetimes, as "start:1h:6h:24h:
+### peak:end" pages.  The new lines go to ${LF_DATA}2 and the alerts to
+### ${LF_DATA}a
+####################################################################
+lifetime_cycle(){
+	if [ ! -f ${LF_DATA} ]
+	then
+		>${LF_DATA}
+	fi
+	awk -v rules="${Filter_file}" -v pagesize=$Pagesize \
+	    -v growth=$Growth_cnt -v priority=$Priority -v category=$Category \
+	    -v now=$Now -v hz=$Hz -v state=${LF_DATA}2 -v alerts=${LF_DATA}a \
+	    "$Policy_awk$Cgroup_awk"'
+	BEGIN {
+		LIVES = 4; FORGET = 30 * 86400
+		getline up < "/proc/uptime"
+		close("/proc/uptime")
+		up += 0
+	}
+	FILENAME == ARGV[1] {
+		if ($1 == "L") {
+			pid = $2; lst[pid] = $3; lkey[pid] = $4; lrel[pid] = $5
+			lnm[pid] = $6; l0[pid] = $7; l1[pid] = $8; l6[pid] = $9
+			l24[pid] = $10; lpk[pid] = $11; lend[pid] = $12
+		} else if ($1 == "E") {
+			k = $2; erel[k] = $3; en[k] = $4; egr[k] = $5
+			eb[k] = $6; enb[k] = $7; epb[k] = $8; elast[k] = $9
+			elives[k] = $10
+		}
+		next
+	}
+	$1 == "PID" || $1 == 0 { next }
+	{
+		pid = $1; name = $2; size = $3
+		r = policy(name)
+		if (ign[r] || !rlife[r] || (st = starttime(pid)) == "")
+			next
+		if (!(pid in lst) || lst[pid] != st) {
+			# a pid reused is a lifetime ended
+			if (pid in lst)
+				ended(pid)
+			lst[pid] = st; lnm[pid] = name; identity(pid, name)
+			l0[pid] = size; l1[pid] = l6[pid] = l24[pid] = 0
+			lpk[pid] = 0
+		}
+		alive[pid] = 1
+		age = up - st / hz
+		if (l1[pid] == 0 && age >= 3600) {
+			l1[pid] = size
+			baseline(pid, r)
+		}
+		if (l6[pid] == 0 && age >= 21600)
+			l6[pid] = size
+		if (l24[pid] == 0 && age >= 86400)
+			l24[pid] = size
+		if (size > lpk[pid])
+			lpk[pid] = size
+		lend[pid] = size
+	}
+	END {
+		for (pid in lst)
+			if (!(pid in alive))
+				ended(pid)
+			else {
+				live[lkey[pid]] = 1
+				printf("L %s %s %s %s %s %d %d %d %d %d %d\n", pid,
+				    lst[pid], lkey[pid], lrel[pid], lnm[pid], l0[pid],
+				    l1[pid], l6[pid], l24[pid], lpk[pid], lend[pid]) > state
+			}
+		# an executable no longer run is forgotten after a while
+		for (k in erel)
+			if ((k in live) || now - elast[k] < FORGET)
+				printf("E %s %s %d %d %d %d %d %d %s\n", k, erel[k],
+				    en[k], egr[k], eb[k], enb[k], epb[k], elast[k],
+				    elives[k]) > state
+	}
+	# the starttime of pid in clock ticks, or ""
+	function starttime(pid,    f, line, x) {
+		f = "/proc/" pid "/stat"
+		line = ""
+		getline line < f
+		close(f)
+		sub(/.*\) /, "", line)
+		return split(line, x, " ") >= 20 ? x[20] : ""
+	}
+	# the executable and memory cgroup of pid as lkey, and the mtime of
+	# the executable as lrel
+	function identity(pid, name,    cmd, exe, rel, line, cg) {
+		cmd = "readlink /proc/" pid "/exe 2>/dev/null && stat -L -c %Y /proc/" pid "/exe 2>/dev/null"
+		exe = "[" name "]"; rel = "-"
+		if ((cmd | getline line) > 0) {
+			exe = line
+			sub(/ \(deleted\)$/, "", exe)
+			if ((cmd | getline line) > 0)
+				rel = line
+		}
+		close(cmd)
+		lkey[pid] = exe "@" ((cg = memcg(pid)) == "" ? "/" : cg)
+		gsub(/ /, "\\040", lkey[pid])
+		lrel[pid] = rel
+		if (!(lkey[pid] in erel)) {
+			erel[lkey[pid]] = "-"; en[lkey[pid]] = egr[lkey[pid]] = 0
+			elives[lkey[pid]] = "-"
+		}
+	}
+	# the size an hour in of a lifetime: the baseline of its release,
+	# where a newer release than the last starts a new one
+	function baseline(pid, r,    k, rel, b) {
+		k = lkey[pid]; rel = lrel[pid]
+		if (rel != "-" && (erel[k] == "-" || rel + 0 > erel[k] + 0)) {
+			if (enb[k] > 0)
+				epb[k] = int(eb[k] / enb[k])
+			erel[k] = rel; eb[k] = enb[k] = 0
+			b = epb[k]
+			if (b > 0 && l1[pid] - b >= rmin[r] && l1[pid] >= b + rrate[r] &&
+			    l1[pid] * 10 > b * 11) {
+				nalert++
+				printf("%s %d 0 %s %s executable <%s> is %d pages an hour into its new release, up from %d pages with the release before; its baseline has risen\n",
+				    k, l1[pid], rp[r], rc[r] == "-" ? category : rc[r], k, l1[pid], b) > alerts
+			}
+		}
+		if (rel == erel[k]) {
+			eb[k] += l1[pid]; enb[k]++
+		}
+	}
+	# fold the lifetime of pid into its executable
+	function ended(pid,    k, r, b, n, x, i) {
+		k = lkey[pid]
+		r = policy(lnm[pid])
+		n = split(elives[k] == "-" ? "" : elives[k], x, ",")
+		elives[k] = l0[pid] ":" l1[pid] ":" l6[pid] ":" l24[pid] ":" lpk[pid] ":" lend[pid]
+		for (i = n; i > n - LIVES + 1 && i > 0; i--)
+			elives[k] = x[i] "," elives[k]
+		en[k]++; elast[k] = now
+		# larger at the end than after its start, or an hour in
+		b = l1[pid] > 0 ? l1[pid] : l0[pid]
+		if (lend[pid] - b >= rmin[r] && lend[pid] >= b + rrate[r]) {
+			if (++egr[k] >= rlife[r]) {
+				nalert++
+				printf("%s %d 0 %s %s executable <%s> has ended %d lifetimes running larger than it started, the last from %d pages to %d pages with a peak of %d pages; a possible memory leak across restarts\n",
+				    k, lend[pid], rp[r], rc[r] == "-" ? category : rc[r], k, egr[k], b, lend[pid], lpk[pid]) > alerts
+			}
+		} else
+			egr[k] = 0
+	}' ${LF_DATA} ${CR_DATA}
+}
+
+####################################################################
+### This func is used to run the lifetimes of a profile whose filter
+### has 'lifetimes' rules, its alerts going out with those of the
+### processes and counted with them in Nalerts
+####################################################################
+watch_lifetimes(){
+	>${LF_DATA}2
+	>${LF_DATA}a
+	lifetime_cycle
+	echo "PID memmon-lifetimes time=$Now" > ${LF_DATA}
+	cat ${LF_DATA}2 >> ${LF_DATA}
+	if [ -s ${LF_DATA}a ]
+	then
+		Nlife=`wc -l < ${LF_DATA}a`
+		Nalerts=$((Nalerts + Nlife))
+		if [ -n "$P_out" ]
+		then
+			project_alerts ${LF_DATA}a >> "$P_out"
+		else
+			project_alerts ${LF_DATA}a
+		fi
+	fi
+	rm ${LF_DATA}2 ${LF_DATA}a
+}
+
+####################################################################
+### This func is used to sample the memory the kernel holds outside the
+### processes into ${KC_DATA}, lines of "name pages": the slab caches,
+### the Shmem, PageTables and SUnreclaim of /proc/meminfo, the System V
+### shared memory segments, and the space used on each tmpfs mount
+####################################################################
+collect_kernel_data(){
+	awk -v pagesize=$Pagesize '
+	BEGIN {
+		# slabinfo is only readable by root; SLUB has sysfs too
+		if ((getline line < "/proc/slabinfo") > 0) {
+			while ((getline line < "/proc/slabinfo") > 0) {
+				n = split(line, f, " ")
+				if (f[1] !~ /^#/ && n >= 15)
+					printf("slab:%s %d\n", f[1], f[15] * f[6])
+			}
+		} else {
+			# a merged cache shows up under each of its names
+			cmd = "grep . /sys/kernel/slab/*/slabs /sys/kernel/slab/*/order 2>/dev/null"
+			while ((cmd | getline line) > 0) {
+				split(line, f, "[/: ]")
+				if (f[5] == "")
+					continue
+				if (f[6] == "slabs")
+					slabs[f[5]] = f[7]
+				else
+					order[f[5]] = f[7]
+			}
+			close(cmd)
+			for (c in slabs)
+				printf("slab:%s %d\n", c, slabs[c] * 2 ^ order[c])
+		}
+		close("/proc/slabinfo")
+		while ((getline line < "/proc/meminfo") > 0) {
+			split(line, f, "[: ]+")
+			if (f[1] == "Shmem" || f[1] == "PageTables" || f[1] == "SUnreclaim")
+				printf("meminfo:%s %d\n", f[1], int(f[2] * 1024 / pagesize))
+		}
+		# key shmid perms size cpid lpid nattch ...
+		all = orphaned = 0
+		if ((getline line < "/proc/sysvipc/shm") > 0) {
+			while ((getline line < "/proc/sysvipc/shm") > 0) {
+				split(line, f, " ")
+				all += f[4]
+				if (f[7] == 0)
+					orphaned += f[4]
+			}
+			printf("sysvshm:all %d\n", int(all / pagesize))
+			printf("sysvshm:orphaned %d\n", int(orphaned / pagesize))
+		}
+		close("/proc/sysvipc/shm")
+	}' > ${KC_DATA}
+	Tmpfs=`awk '$3 == "tmpfs" { print $2 }' /proc/mounts 2>/dev/null | sort -u`
+	if [ -n "$Tmpfs" ]
+	then
+		df -P -k $Tmpfs 2>/dev/null | awk -v pagesize=$Pagesize '
+		NR > 1 { printf("tmpfs:%s %d\n", $NF, int($3 * 1024 / pagesize)) }' >> ${KC_DATA}
+	fi
+}
+
+####################################################################
+### This func is used to run the kernel counters in ${KC_DATA} through
+### the growth count and rate of merge_cycle, against their records of
+### the last cycle in ${KS_DATA}, lines of "name size isize growth
+### rate" after a header with the time; the new records go to
+### ${KS_DATA}2 and the alerts, under the -k category, to ${KS_DATA}a
+####################################################################
+kernel_cycle(){
+	if [ ! -f ${KS_DATA} ]
+	then
+		>${KS_DATA}
+	fi
+	awk -v rules="${Filter_file}" -v pagesize=$Pagesize \
+	    -v growth=$Growth_cnt -v priority=$Priority -v category=$Kernel_cat \
+	    -v now=$Now -v state=${KS_DATA}2 -v alerts=${KS_DATA}a "$Policy_awk"'
+	FILENAME == ARGV[1] {
+		if ($1 == "PID") {
+			if (match($0, / time=[0-9]+/))
+				elapsed = now - substr($0, RSTART + 6, RLENGTH - 6)
+		} else {
+			sz[$1] = $2; isz[$1] = $3; grw[$1] = $4; rt[$1] = $5
+		}
+		next
+	}
+	{
+		name = $1; size = $2; is = size; g = 0; rate = 0
+		r = policy(name)
+		if (ign[r])
+			next
+		cat = rc[r] == "-" ? category : rc[r]
+		if (name in sz) {
+			is = isz[name]; g = grw[name]; rate = rt[name]
+			if (elapsed > 0)
+				rate = int((rate + int((size - sz[name]) * 3600 / elapsed)) / 2)
+			if (size >= sz[name] + rrate[r]) {
+				if (++g >= rg[r] && size - is >= rmin[r])
+					printf("%s %d %d %s %s kernel memory <%s> has grown %d times, from %d pages to %d pages, a possible kernel memory leak\n",
+					    name, size, rate, rp[r], cat, name, g, is, size) > alerts
+			} else if (size < sz[name])
+				g = 0
+			if (rmax[r] > 0 && size > rmax[r])
+				printf("%s %d %d %s %s kernel memory <%s> is %d pages, over its limit of %d pages\n",
+				    name, size, rate, rp[r], cat, name, size, rmax[r]) > alerts
+		}
+		printf("%s %d %d %d %d\n", name, size, is, g, rate) > state
+	}' ${KS_DATA} ${KC_DATA}
+}
+
+####################################################################
+### This func is used to watch the memory of the kernel for -k, its
+### alerts going out with the pressure of the cycle
+####################################################################
+watch_kernel(){
+	Now=`getdate now`
+	collect_kernel_data
+	>${KS_DATA}2
+	>${KS_DATA}a
+	kernel_cycle
+	echo "PID memmon-kernel time=$Now" > ${KS_DATA}
+	cat ${KS_DATA}2 >> ${KS_DATA}
+	if [ -s ${KS_DATA}a ]
+	then
+		project_alerts ${KS_DATA}a
+	fi
+	rm ${KC_DATA} ${KS_DATA}2 ${KS_DATA}a
+}
+
+####################################################################
+### This func is used to arm the allocation tracker of each process in
+### ${PS_DATA}a that has libmemmon-track.so loaded, or if memmon armed
+### it before to ask it for a new report; the alerts name the last one.
+### A process is only signalled while its maps show the tracker, as the
+### signal would kill one without it
+####################################################################
+track_alerts(){
+	Track_dir=${MEMMON_TRACK_DIR:-/tmp}
+	Track_sig=${MEMMON_TRACK_SIGNAL:-USR2}
+	Signalled=" "
+	>${TR_DATA}1
+	while read T_pid T_rest
+	do
+		T_note=
+		if grep libmemmon-track /proc/${T_pid}/maps >/dev/null 2>&1
+		then
+			case "$Signalled" in
+			*" ${T_pid} "*)
+				;;
+			*)
+				kill -${Track_sig} ${T_pid} 2>/dev/null
+				Signalled="${Signalled}${T_pid} "
+				;;
+			esac
+			if grep "^${T_pid}\$" ${TR_DATA} >/dev/null 2>&1
+			then
+				T_note="; allocations tracked in ${Track_dir}/memmon-track.${T_pid}"
+				T_top=`awk '!/^#/ { $2 = "bytes from"; $3 = $3 " at"
+				    if (NF > 6) NF = 6; print; exit }' ${Track_dir}/memmon-track.${T_pid} 2>/dev/null`
+				if [ -n "$T_top" ]
+				then
+					T_note="${T_note}, top ${T_top}"
+				fi
+			else
+				T_note="; allocation tracking armed"
+			fi
+			echo ${T_pid} >> ${TR_DATA}1
+		fi
+		echo "${T_pid} ${T_rest}${T_note}"
+	done < ${PS_DATA}a > ${PS_DATA}t
+	mv ${PS_DATA}t ${PS_DATA}a
+	# keep the processes still alive that were armed before
+	if [ -s ${TR_DATA} ]
+	then
+		while read T_pid
+		do
+			if [ -d /proc/${T_pid} ]
+			then
+				echo ${T_pid}
+			fi
+		done < ${TR_DATA} >> ${TR_DATA}1
+	fi
+	sort -u ${TR_DATA}1 > ${TR_DATA}
+	rm ${TR_DATA}1
+}
+
+####################################################################
+### This func is used to run recorded snapshots through the detector;
+### $1 is the growth count, $2 a file listing the snapshots, which may
+### be 'ps -el' output or memmon records, and $3 their directory.
+### memreplay, when installed, prints the same report
+####################################################################
+replay_snapshots(){
+	if [ "$Replayer" = "memreplay" ]
+	then
+		memreplay -d $3 -f "${Filter_file}" -g $1 < $2
+		return
+	fi
+	awk -v rules="${Filter_file}" -v pagesize=$Pagesize \
+	    -v growth=$1 -v priority=$Priority -v list=$2 -v dir=$3 "$Policy_awk"'
+	BEGIN {
+		while ((getline path < list) > 0) {
+			snap = substr(path, length(dir) + 2)
+			nsnap++
+			ps = -1
+			while ((getline < path) > 0) {
+				if (ps < 0)
+					ps = $4 == "PID"
+				if (ps) {
+					pid = $4; name = $NF; size = $10
+				} else {
+					pid = $1; name = $2; size = $3
+				}
+				if (pid == "PID" || pid == 0 || ign[r = policy(name)])
+					continue
+				detect()
+			}
+			close(path)
+		}
+		printf("growth %d: %d processes flagged, %d alerts, %d records in %d snapshots\n",
+		    growth, nflag, nalert, nrec, nsnap)
+	}
+	function detect() {
+		nrec++
+		# a pid missing from the last snapshot is a new process
+		if (seen[pid] != nsnap - 1 || nm[pid] != name) {
+			nm[pid] = name; isz[pid] = size; grw[pid] = 0
+		} else if (size >= prev[pid] + rrate[r]) {
+			if (++grw[pid] >= rg[r] && size - isz[pid] >= rmin[r]) {
+				nalert++
+				if (!((pid, name) in flagged)) {
+					flagged[pid, name]; nflag++
+					printf("%s: process <%s %s> has grown %d times, from %d pages to %d pages\n",
+					    snap, pid, name, grw[pid], isz[pid], size)
+				}
+			}
+		} else if (size < prev[pid])
+			grw[pid] = 0
+		if (rmax[r] > 0 && size > rmax[r]) {
+			nalert++
+			if (!((pid, name) in capped)) {
+				capped[pid, name]; nflag++
+				printf("%s: process <%s %s> is %d pages, over its limit of %d pages\n",
+				    snap, pid, name, size, rmax[r])
+			}
+		}
+		prev[pid] = size
+		seen[pid] = nsnap
+	}'
+}
+
+####################################################################
+### This func is used to backtest each growth count in $Growth_cnt,
+### in parallel, against the snapshots in $Replay (a directory or a
+### tar archive); snapshots are replayed in file name order
+####################################################################
+run_replay(){
+	Replay_tmp=/tmp/msreplay_$$
+	if [ -d "$Replay" ]
+	then
+		Replay_dir=$Replay
+	elif [ -f "$Replay" ]
+	then
+		Replay_dir=${Replay_tmp}.d
+		mkdir ${Replay_dir} && tar -xf "$Replay" -C ${Replay_dir} ||
+		    err_quit "Cannot unpack $Replay"
+	else
+		err_quit "No snapshots at $Replay"
+	fi
+	find ${Replay_dir} -type f | sort > ${Replay_tmp}
+	if [ ! -s ${Replay_tmp} ]
+	then
+		rm ${Replay_tmp}
+		err_quit "No snapshots at $Replay"
+	fi
+
+	if type memreplay >/dev/null 2>&1
+	then
+		Replayer=memreplay
+	else
+		Replayer=awk
+	fi
+	Sweep=`echo $Growth_cnt | tr , ' '`
+	for Replay_growth in $Sweep
+	do
+		replay_snapshots $Replay_growth ${Replay_tmp} ${Replay_dir} \
+		    >${Replay_tmp}.$Replay_growth &
+	done
+	wait
+	for Replay_growth in $Sweep
+	do
+		cat ${Replay_tmp}.$Replay_growth
+		rm ${Replay_tmp}.$Replay_growth
+	done
+	rm ${Replay_tmp}
+	if [ "$Replay_dir" != "$Replay" ]
+	then
+		rm -rf ${Replay_dir}
+	fi
+}
+
+####################################################################
+### This func is used to switch to profile ${P_name}, whose options in
+### ${P_opts} override those of the command line; it has a state file
+### and stats of its own, and its alerts go to ${P_out} when it is set
+####################################################################
+use_profile(){
+	Category=$Opt_category
+	Priority=$Opt_priority
+	Growth_cnt=$Opt_growth
+	Filter_file=$Opt_filter
+	P_out=
+	PS_DATA=${Ps_base}.${P_name}
+	ST_DATA=${St_base}.${P_name}
+	LF_DATA=${Lf_base}.${P_name}
+	set -- $P_opts
+	while [ $# -gt 0 ]
+	do
+		if [ $# -lt 2 ]
+		then
+			err_quit "profile ${P_name}: $1 needs a value"
+		fi
+		case $1 in
+		-c)	Category=$2;;
+		-f)	Filter_file=$2;;
+		-g)	Growth_cnt=$2;;
+		-o)	P_out=$2;;
+		-p)	Priority=$2;;
+		*)	err_quit "profile ${P_name}: unknown option $1";;
+		esac
+		shift 2
+	done
+}
+
+####################################################################
+### This func is used to run $1 for each profile in ${Profiles}, lines
+### of "name [-c category] [-f filter] [-g growth] [-o alerts file]
+### [-p priority]", and then go back to the command line options
+####################################################################
+for_profiles(){
+	P_func=$1
+	while read P_name P_opts
+	do
+		case "$P_name" in
+		""|\#*)
+			continue
+			;;
+		esac
+		use_profile
+		$P_func
+	done < ${Profiles}
+	Category=$Opt_category
+	Priority=$Opt_priority
+	Growth_cnt=$Opt_growth
+	Filter_file=$Opt_filter
+	P_out=
+	PS_DATA=$Ps_base
+	ST_DATA=$St_base
+	LF_DATA=$Lf_base
+}
+
+####################################################################
+### This func is used to check a profile and note what the shared scan
+### needs for it: its filter, for memscan, and whether it has a state
+### file yet
+####################################################################
+check_profile(){
+	case "$P_name" in
+	*[!A-Za-z0-9_]*)
+		err_quit "profile ${P_name}: use only letters, digits and _ in a name"
+		;;
+	esac
+	if [ "$Priority" -lt 1 -o "$Priority" -gt 10 ]; then
+		err_quit "profile ${P_name}: invalid priority; 1 <=  p <= 10"
+	fi
+	Scan_opts="$Scan_opts -t ${Filter_file}"
+	if [ -z "$Gauge_state" ]; then
+		Gauge_state=${PS_DATA}
+	fi
+	if [ ! -s ${PS_DATA} ]; then
+		Missing="$Missing ${P_name}"
+	fi
+}
+
+####################################################################
+### This func is used collect base line information, written in the
+### layout of the state file the merge reads it back as: pid name size
+### isize growth rate faults, and the threads and address space in the
+### thread fields when memscan -t reports them
 ####################################################################
 collect_baseline_data(){
-	ps -el|awk ' { print $4, $NF, $10, $10, 0 } ' >${PS_DATA}
+	if [ "$Collector" = "memscan" ]
+	then
+		memscan $Scan_opts | awk ' { if (NF >= 9)
+			print $1, $2, $3, $4, 0, 0, $6, 0, 0, 0, 0, $8, $8, $9, 0
+		    else
+			print $1, $2, $3, $4, 0, 0, $6 } ' >${PS_DATA}
+	else
+		ps -el|awk ' { print $4, $NF, $10, $10, 0, 0, 0 } ' >${PS_DATA}
+	fi
 }
 
 ####################################################################
 ### This func is used collect current information
 ####################################################################
 collect_current_data(){
-	ps -el|awk ' { print $4, $NF, $10, $10, 0 } ' >${CR_DATA}
+	if [ "$Collector" = "memscan" ]
+	then
+		memscan $Scan_opts >${CR_DATA}
+	else
+		ps -el|awk ' { print $4, $NF, $10, $10, 0, "-", $5 } ' >${CR_DATA}
+	fi
 }
 
 #
@@ -66,14 +1407,33 @@ Category=$ME
 Priority=3
 Growth_cnt=10
 Filter_file=./memfilt
+Stats=no
+Interval=
+Kernel=no
+Kernel_cat=
+Cpu=
+Coverage=100
+Ceiling=
+Limit=
+Replay=
+Track=no
+Profiles=
  
-while getopts c:f:g:p: arg
+while getopts C:c:f:g:i:k:m:P:p:r:st arg
 do
     case $arg in
+        C) Cpu=$OPTARG;;
         c) Category=$OPTARG;;
         f) Filter_file=$OPTARG;;
         g) Growth_cnt=$OPTARG;;
+        i) Interval=$OPTARG;;
+        k) Kernel=yes; Kernel_cat=$OPTARG;;
+        m) Ceiling=$OPTARG;;
+        P) Profiles=$OPTARG;;
         p) Priority=$OPTARG;;
+        r) Replay=$OPTARG;;
+        s) Stats=yes;;
+        t) Track=yes;;
        \?) err_use ;;
     esac
 done
@@ -81,6 +1441,11 @@ done
 
 PS_DATA=/tmp/psdata_`uname -n`;export PS_DATA
 CR_DATA=/tmp/crdata_`uname -n`;export CR_DATA
+ST_DATA=/tmp/msstats_`uname -n`;export ST_DATA
+TR_DATA=/tmp/mstrack_`uname -n`;export TR_DATA
+LF_DATA=/tmp/lfdata_`uname -n`;export LF_DATA
+KS_DATA=/tmp/ksdata_`uname -n`;export KS_DATA
+KC_DATA=/tmp/kcdata_`uname -n`;export KC_DATA
 
 if [ -z "$Priority" ]; then
   err_quit "Must specify priority number with -p option"
@@ -102,12 +1467,131 @@ fi
 if [ -z "$Growth_cnt" ]; then
   err_quit "Must specify a growth count when using -g option"
 fi
+
+if [ "$Kernel" = "yes" ] && [ -z "$Kernel_cat" ]; then
+  err_quit "Must specify category when using -k option"
+fi
+
+if [ -n "$Interval" ] && [ "$Interval" -lt 1 ]; then
+  err_quit "Invalid interval; must be at least 1 second"
+fi
+
+case "$Cpu" in
+*[!0-9.]*|.|*.*.*)
+  err_quit "Invalid CPU budget; a percentage of one core" ;;
+?*)
+  awk "BEGIN { exit !($Cpu > 0 && $Cpu <= 100) }" ||
+    err_quit "Invalid CPU budget; must be over 0 and at most 100" ;;
+esac
+
+# the names and numbers libmemmon-track.so takes for its signal
+if [ "$Track" = "yes" ]; then
+  T_sig=${MEMMON_TRACK_SIGNAL:-USR2}
+  case "${T_sig#SIG}" in
+  USR[12]|RTMIN|RTMIN+[0-9]|RTMIN+[12][0-9]|RTMIN+30) ;;
+  [1-9]|[1-5][0-9]|6[0-4]) ;;
+  *) err_quit "Invalid MEMMON_TRACK_SIGNAL; USR1, USR2, RTMIN+n or a number" ;;
+  esac
+fi
+
+# -m is held as the number of processes it leaves room for, 1 kB each
+if [ -n "$Ceiling" ]; then
+  Limit=${Ceiling%[KkMmGg]}
+  case "$Limit" in
+  ""|*[!0-9]*) err_quit "Invalid size for -m; bytes, or K, M or G" ;;
+  esac
+  case "$Ceiling" in
+  *[Kk]) ;;
+  *[Mm]) Limit=$((Limit * 1024)) ;;
+  *[Gg]) Limit=$((Limit * 1048576)) ;;
+  *) Limit=$((Limit / 1024)) ;;
+  esac
+  if [ "$Limit" -lt 1 ]; then
+    err_quit "Invalid size for -m; must be at least 1K"
+  fi
+fi
+
+Pagesize=`getconf PAGESIZE 2>/dev/null`
+if [ -z "$Pagesize" ]; then
+  Pagesize=4096
+fi
+Hz=`getconf CLK_TCK 2>/dev/null`
+if [ -z "$Hz" ]; then
+  Hz=100
+fi
+
+# numa rules only read anything with two or more of the first 8 nodes
+Numa=0
+Nodes=0
+for Node in 0 1 2 3 4 5 6 7
+do
+  if [ -d /sys/devices/system/node/node$Node ]; then
+    Nodes=$((Nodes + 1))
+    Numa=$((Node + 1))
+  fi
+done
+if [ $Nodes -lt 2 ]; then
+  Numa=0
+fi
+
+if [ -n "$Replay" ]; then
+  run_replay
+  exit 0
+fi
+
+####################################################################
+### Read /proc with the native collector when it is installed
+####################################################################
+if type memscan >/dev/null 2>&1 && [ -r /proc/self/statm ]
+then
+	Collector=memscan
+else
+	Collector=ps
+fi
+if type memmerge >/dev/null 2>&1
+then
+	Merger=memmerge
+else
+	Merger=awk
+fi
+
+####################################################################
+### With -P the profiles share the scan and the pressure gauge; each
+### merges the scan into ${PS_DATA}.<name>, and the gauge reads the
+### limit events of the last cycle from the first of them
+####################################################################
+Opt_category=$Category
+Opt_priority=$Priority
+Opt_growth=$Growth_cnt
+Opt_filter=$Filter_file
+Ps_base=$PS_DATA
+St_base=$ST_DATA
+Lf_base=$LF_DATA
+Scan_opts=
+Gauge_state=
+Missing=
+if [ -n "$Profiles" ]
+then
+	if [ ! -r "$Profiles" ]; then
+		err_quit "Cannot read the profiles in $Profiles"
+	fi
+	for_profiles check_profile
+	if [ -z "$Gauge_state" ]; then
+		err_quit "No profiles in $Profiles"
+	fi
+else
+	Scan_opts="-t ${Filter_file}"
+	Gauge_state=${PS_DATA}
+	if [ ! -s ${PS_DATA} ]; then
+		Missing=${PS_DATA}
+	fi
+fi
  
 ####################################################################
 ### Get baseline data if it does not exist and we have been up
 ### at least 10 Minutes
 ####################################################################
-if [ ! -s ${PS_DATA} ]
+if [ -n "$Missing" ]
 then
 	Boottime=`getdate "\`who -r | awk '{print $3, $4, $5}'\` \`date +%Z\`"`
 	Currenttime=`getdate now`
@@ -124,84 +1608,202 @@ then
 	if [ $Uptime -ge 600 ]
 	then
 		collect_baseline_data
+		if [ -n "$Profiles" ]
+		then
+			for P_name in $Missing
+			do
+				cp ${PS_DATA} ${PS_DATA}.${P_name}
+			done
+			rm ${PS_DATA}
+		fi
 	else 
 		# Wait until the system is up at least 10 minutes
 		exit 0
 	fi
 fi
 
-#
-#get the current memory sizes used by all processes
-#
-collect_current_data
-
-sort -n -o ${PS_DATA}1 -k 1 -k 1,1 ${PS_DATA}
-sort -n -o ${CR_DATA}1 -k 1 -k 1,1 ${CR_DATA}
-
->${PS_DATA}2
-sc_pid=0
-b_pid=0
-
-while read c_pid c_proc c_size c_isize c_growth  # read current PS info
-do
-
-	# skip Header line
-	if [ "${c_pid}" = "PID" ]
+####################################################################
+### This func is used to report a process memscan saw exit
+####################################################################
+process_exit(){
+	echo ${X_pid} >> ${CR_DATA}x
+	if [ -n "$Profiles" ]
 	then
-		continue
+		for_profiles exit_alert
+	else
+		exit_alert
 	fi
+}
 
-	if [ "${c_pid}" -eq "0" ] # skip the header line
+####################################################################
+### This func is used to alert on a process that exited while it was
+### growing, by the suspects of the last cycle
+####################################################################
+exit_alert(){
+	if [ -n "$Profiles" ]
 	then
-		continue
+		eval "Suspects=\$Suspects_${P_name}"
 	fi
-
-	# Test for filtering
-	if [ -s ${Filter_file} ]
-	then
-		#skip if the proc is in the filter file
-		grep ${c_proc} ${Filter_file} 2>&1 > /dev/null
-		if [ $? -eq 0 ]
+	case "$Suspects" in
+	*" ${X_pid}:"*)
+		X_hist=${Suspects#*" ${X_pid}:"}
+		X_hist=${X_hist%% *}
+		X_alert="-p $Priority -c $Category -m \"process <${X_pid} ${X_proc}> exited at ${X_size} pages after growing ${X_hist%:*} times from ${X_hist#*:} pages; ${Pressure_ctx}\""
+		if [ -n "$P_out" ]
 		then
-			continue
+			echo "$X_alert" >> "$P_out"
+		else
+			echo "$X_alert"
 		fi
+		;;
+	esac
+}
+
+####################################################################
+### This func is used to gauge the pressure once and merge the current
+### data into the baseline of each profile
+####################################################################
+run_cycle(){
+	read_pressure
+	end_phase gauge
+	if [ "$Kernel" = "yes" ]
+	then
+		watch_kernel
+		end_phase kernel
+	fi
+	Cycle_times=$Phase_times
+	if [ -n "$Profiles" ]
+	then
+		for_profiles merge_profile
+	else
+		merge_profile
 	fi
+	if [ -s ${CR_DATA}x ]
+	then
+		rm ${CR_DATA}x
+	fi
+}
 
-	while [ "${c_pid}" -gt "${b_pid}" ]
-	do
-		# read baseline PS info
-		read -u3 b_pid b_proc b_size b_isize b_growth
-		if [ $? -gt 0 ] #end of file
+####################################################################
+### This func is used to merge the current data into the baseline
+####################################################################
+merge_profile(){
+	Phase_times=$Cycle_times
+	# the growth rates are per hour of the time since the last cycle
+	Elapsed=0
+	Now=`getdate now`
+	read Header < ${PS_DATA}
+	case "$Header" in
+	"PID memmon-stats"*" time="*)
+		Elapsed=${Header##* time=}
+		Elapsed=$((Now - ${Elapsed%% *}))
+		;;
+	esac
+
+	>${PS_DATA}2
+	>${PS_DATA}a
+	Merged=`merge_cycle`
+	Nseen=${Merged%% *}
+	Merged=${Merged#* }
+	Nalerts=${Merged%% *}
+	Merged=${Merged#* }
+	Nexited=${Merged%% *}
+	Merged=${Merged#* }
+	Nstatus=${Merged%% *}
+	Merged=${Merged#* }
+	Nskipped=${Merged%% *}
+	Suspects=" ${Merged#* }"
+	if [ -n "$Profiles" ]
+	then
+		eval "Suspects_${P_name}=\$Suspects"
+	fi
+	if [ -s ${PS_DATA}a ]
+	then
+		if [ "$Track" = "yes" ]
 		then
-			b_pid=0
-			break
+			track_alerts
 		fi
-		if [ "${b_pid}" = "PID" ]
+		if [ -n "$P_out" ]
 		then
-			b_pid=0
-			continue
+			project_alerts >> "$P_out"
+		else
+			project_alerts
 		fi
-	done
+	fi
+	if grep '^[^#]*[ 	]lifetimes' "${Filter_file}" >/dev/null 2>&1
+	then
+		watch_lifetimes
+	fi
+	end_phase merge
+
+	Nwritten=`wc -l < ${PS_DATA}2`; Nwritten=$((Nwritten))
+	Nbytes=`wc -c < ${CR_DATA}`; Nbytes=$((Nbytes))
+	Counts="seen=$Nseen written=$Nwritten exited=$Nexited bytes=$Nbytes status=$Nstatus skipped=$Nskipped alerts=$Nalerts${Cpu:+ coverage=$Coverage}"
+	echo "PID memmon-stats$Phase_times $Counts pressure=$Pressure limits=$Pressure_limits time=$Now" > ${PS_DATA}
+	cat ${PS_DATA}2 >> ${PS_DATA}
+	rm ${PS_DATA}2 ${PS_DATA}a
+	end_phase persist
 
-	if [ "${c_pid}" -eq "${b_pid}" ]
+	if [ -n "$Profiles" ] && [ "$Stats" = "yes" ]
 	then
-		if [ ${c_size} -gt ${b_size} ]
-		then
-			b_growth=`expr $b_growth + 1`
-			if [ "${b_growth}" -ge "${Growth_cnt}" ]
-			then 
-				echo "-p $Priority -c $Category -m \"process <${c_pid} ${c_proc}> has grown ${b_growth} times, from ${b_isize} pages to ${c_size} pages, this process has a possible memory leak\""
+		echo "${P_name}:" 1>&2
+	fi
+	update_stats "$Phase_times $Counts"
+}
+
+#
+#get the current memory sizes used by all processes
+#
+if [ -n "$Interval" ]
+then
+	if [ "$Collector" = "memscan" ]
+	then
+		# memscan replaces ${CR_DATA} and prints a line every cycle
+		memscan -e -p -i $Interval ${Cpu:+-C $Cpu} -o ${CR_DATA} \
+		    $Scan_opts |
+		while read Cycle X_pid X_proc X_size
+		do
+			if [ "$Cycle" = "X" ]
+			then
+				process_exit
+				continue
 			fi
-		elif [ ${c_size} -lt ${b_size} ]
-		then
-			b_growth=0
-		fi
-		printf "%s\t%-20s\t%d\t%d\t%d\n" ${c_pid} ${c_proc} ${c_size} ${b_isize} ${b_growth}>> ${PS_DATA}2
+			# with -C a cycle line also has the percentage read
+			Coverage=${X_pid:-100}
+			Phase_times=
+			read_clock
+			run_cycle
+		done
 	else
-		printf "%s\t%-20s\t%d\t%d\t0\n" ${c_pid} ${c_proc} ${c_size} ${c_isize} >>${PS_DATA}2
+		while :
+		do
+			Phase_times=
+			read_clock
+			collect_current_data
+			end_phase scan
+			run_cycle
+			rm ${CR_DATA}
+			case $Pressure in
+			high)	Sleep=$((Interval / 4));;
+			rising)	Sleep=$((Interval / 2));;
+			idle)	Sleep=$((Interval * 2));;
+			*)	Sleep=$Interval;;
+			esac
+			if [ $Sleep -lt 1 ]
+			then
+				Sleep=1
+			fi
+			sleep $Sleep
+		done
 	fi
-done < ${CR_DATA}1 3< ${PS_DATA}1
-cp ${PS_DATA}2 ${PS_DATA}
-rm ${CR_DATA}1 ${PS_DATA}1 ${PS_DATA}2 ${CR_DATA}
+	exit 1
+fi
+
+Phase_times=
+read_clock
+collect_current_data
+end_phase scan
+run_cycle
+rm ${CR_DATA}
 
 exit 0
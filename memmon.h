@@ -0,0 +1,116 @@
+/*
+ * memmon.h - the memmon collector, filter, detector and state file as a
+ * library, for agents that run continuously instead of forking memmon
+ * and parsing its output
+ * @(#) memmon.h 1.1 26/10/19
+ *
+ * A handle is opened, configured with mm_set, optionally loaded from a
+ * state file, and then driven one cycle at a time: mm_sample reads /proc
+ * itself, or mm_begin, mm_gone, mm_feed and mm_end take the records from
+ * elsewhere.  With tree rules in the filter every record of a cycle is
+ * given to mm_link, with its parent, before the first is fed, so that a
+ * supervisor can be watched by the total of its process tree; so too
+ * with a limit (mm_set "limit"), beyond which the smallest processes of
+ * a cycle are skipped to bound the memory of the handle.  With
+ * threads rules mm_threads gives the thread count and address space of
+ * the process fed next; mm_sample walks /proc/<pid>/task for them, up to
+ * a budget of task entries a cycle (mm_set "budget").  On a host with
+ * two or more NUMA nodes the processes of numa rules have their pages on
+ * each node read as they are fed; elsewhere the rules cost nothing.
+ * Alerts go to the callback given to mm_alerts as they are raised.  Once
+ * the tables have grown to the number of processes on the host a cycle
+ * allocates nothing.  A handle is not safe to share between threads.
+ * Functions that can fail return -1 and set errno.
+ *
+ * mm_run is the loop of an agent that has nothing else to do: it runs
+ * mm_sample every interval with the reading of /proc, the detector and
+ * the alerts and state file on three threads, so that a slow callback
+ * or a stalled write costs cycles, counted, but not the cadence of the
+ * scans.  Programs that call it link with -lpthread.
+ */
+#ifndef MEMMON_H
+#define	MEMMON_H
+
+#define	MM_VERSION	1
+#define	MM_NODES	8	/* NUMA nodes followed */
+
+struct memmon;
+
+/*
+ * A process as the detector sees it.  Sizes are pages; rates are per
+ * hour, averaged over the cycles; the high-water marks are kB.
+ */
+struct mm_proc {
+	int	pid;
+	const char *name;
+	long	size;		/* this cycle */
+	long	isize;		/* when first seen */
+	int	growth;		/* cycles it grew in a row */
+	long	rate;		/* pages an hour */
+	long	faults;		/* minflt + majflt, or -1 if not known */
+	long	frate;		/* faults an hour */
+	long	hwm;		/* VmHWM */
+	long	peak;		/* VmPeak */
+	int	warn;		/* early warnings in a row */
+	long	threads;	/* tasks, 0 unless a threads rule */
+	long	ithreads;	/* when they last started to grow */
+	long	ivsize;		/* kB of address space then */
+	int	tgrowth;	/* cycles the threads grew in */
+	int	nnuma;		/* nodes below, 0 unless a numa rule */
+	long	numa[MM_NODES];	/* pages on each NUMA node */
+	long	inuma[MM_NODES];	/* when first seen */
+	int	ngrowth[MM_NODES];	/* cycles each grew in a row */
+};
+
+#define	MM_GROWN	1	/* grew -g times and min= in all */
+#define	MM_CAPPED	2	/* larger than max= */
+#define	MM_EARLY	3	/* faulting and setting high-water marks */
+#define	MM_THREADS	4	/* added threads -g times */
+#define	MM_NUMA		5	/* grew on a NUMA node -g times */
+
+struct mm_alert {
+	int	kind;
+	int	priority;
+	const char *category;
+	const struct mm_proc *proc;
+	const char *message;	/* as memmon prints it after -m */
+};
+
+/*
+ * The counts of the last cycle, as in the memmon-stats header.
+ */
+struct mm_counts {
+	long	seen;
+	long	written;
+	long	exited;
+	long	status;		/* /proc/<pid>/status files read */
+	long	alerts;
+	long	skipped;	/* smallest, past the limit */
+	long	dropped;	/* mm_run: cycles not scanned just before */
+	long	delayed;	/* mm_run: 1 if saved an interval late */
+};
+
+#define	MM_HEADER	0x1	/* mm_save: write the memmon-stats line */
+
+typedef void mm_alert_fn(const struct mm_alert *, void *);
+
+extern struct memmon *mm_open(void);
+extern void mm_close(struct memmon *);
+extern int mm_set(struct memmon *, const char *key, const char *value);
+extern void mm_alerts(struct memmon *, mm_alert_fn *, void *);
+extern int mm_load(struct memmon *, const char *path);
+extern int mm_save(struct memmon *, const char *path, int flags);
+extern int mm_sample(struct memmon *);
+extern int mm_begin(struct memmon *, long elapsed);
+extern int mm_link(struct memmon *, int pid, int ppid, long size);
+extern int mm_gone(struct memmon *, int pid);
+extern int mm_threads(struct memmon *, long threads, long vsize);
+extern int mm_feed(struct memmon *, int pid, const char *name, long size,
+    long isize, long faults);
+extern int mm_end(struct memmon *);
+extern int mm_run(struct memmon *, long interval, long cycles,
+    const char *path);
+extern const struct mm_proc *mm_next(struct memmon *, int *cursor);
+extern const struct mm_counts *mm_counts(struct memmon *);
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * memreplay [-d dir] [-f filter] [-g growth] [-k kernel] [-v] < list -
+ * run the snapshots named in list through the memmon growth detector,
+ * as memmon -r does in awk, printing the same report
+ */
+char ident[] = "@(#) memreplay.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include "growth.h"
+
+#define	MAXFIELDS	64
+#define	NBUCKETS	65536
+#define	ALIGN		64
+#define	MAXKEY		512
+#define	HASH(pid)	(((unsigned) (pid) * 2654435761u >> 7) & pmask)
+
+/*
+ * A string keyed entry of the policy and alert tables.
+ */
+struct ent {
+	struct ent *next;
+	int	val;
+	char	key[1];
+};
+
+/*
+ * A filter rule; rule 0 holds the command line settings.
+ */
+struct rule {
+	int	ign;
+	int	g, min, rate, max;
+};
+
+/*
+ * A flagged slot in snapshot order: a grown alert comes before a capped
+ * one for the same record.
+ */
+struct event {
+	int	pos;
+	int	kind;
+	int	slot;
+};
+
+struct cols cols;		/* hot: what growth_pass reads and writes */
+int *spid;			/* cold: pid, name, last snapshot, record */
+char **sname;
+int *sseen;
+int *spos;
+int nslots, maxslots;
+int *ptab;			/* pid to slot, open addressing */
+int pmask = -1;
+
+struct rule *rules;
+int nrules;
+struct ent *exact[NBUCKETS];	/* names of exact rules */
+struct ent *resolved[NBUCKETS];	/* names already matched to a rule */
+char **pats;			/* pattern rules, in file order */
+int *patrule;
+int npats;
+struct ent *flagged[NBUCKETS];	/* "pid name" alerted for growth */
+struct ent *capped[NBUCKETS];	/* "pid name" alerted for max= */
+
+struct hits hits;
+struct event *events;
+long nflag, nalert;
+double kernsec;			/* time in growth_pass */
+long pagesize;
+char *progname;
+
+static void load_rules();
+static int policy();
+static int pages();
+static int slot();
+static void grow();
+static int *column();
+static void replay();
+static void alert();
+static struct ent *find();
+static int clamp();
+static int bypos();
+
+/*
+ - main - parse arguments and replay the listed snapshots
+ */
+int
+main(int argc, char *argv[])
+{
+	int c, errflg = 0, verbose = 0, growth = 10;
+	char *dir = "", *filter = "./memfilt", *kernel = NULL, *used;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	long nsnap = 0, nrec = 0;
+	struct timespec t0, t1;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, "d:f:g:k:v")) != EOF)
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'g':
+			growth = atoi(optarg);
+			break;
+		case 'k':
+			kernel = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case '?':
+		default:
+			errflg++;
+			break;
+		}
+	if (errflg || optind != argc) {
+		(void) fprintf(stderr,
+		    "Usage: %s [-d dir] [-f filter] [-g growth] [-k avx512|avx2|sse2|scalar] [-v] < list\n",
+		    progname);
+		exit(2);
+	}
+	if ((used = growth_select(kernel)) == NULL) {
+		(void) fprintf(stderr, "%s: %s kernel not available\n",
+		    progname, kernel);
+		exit(2);
+	}
+	if ((pagesize = sysconf(_SC_PAGESIZE)) <= 0)
+		pagesize = 4096;
+	load_rules(filter, growth);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ((n = getline(&line, &len, stdin)) > 0) {
+		if (line[n - 1] == '\n')
+			line[--n] = '\0';
+		nsnap++;
+		replay(line, strlen(dir) < n ? line + strlen(dir) + 1 : line,
+		    nsnap, &nrec);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	(void) printf("growth %d: %ld processes flagged, %ld alerts, %ld records in %ld snapshots\n",
+	    growth, nflag, nalert, nrec, nsnap);
+	if (verbose)
+		(void) fprintf(stderr, "%s: %s kernel, %ld records in %.3f s, %.3f s in the kernel\n",
+		    progname, used, nrec, (t1.tv_sec - t0.tv_sec) +
+		    (t1.tv_nsec - t0.tv_nsec) / 1e9, kernsec);
+	exit(0);
+}
+
+/*
+ - load_rules - compile the filter file as Policy_awk does in memmon
+ */
+static void
+load_rules(char *filter, int growth)
+{
+	FILE *fp;
+	char *line = NULL, *f[MAXFIELDS], *p, *v;
+	size_t len = 0;
+	int i, nf, r;
+	struct rule *rp;
+
+	rules = calloc(1, sizeof(struct rule));
+	if (rules == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	rules[0].g = growth;
+	rules[0].rate = 1;
+	nrules = 1;
+	if ((fp = fopen(filter, "r")) == NULL)
+		return;
+	while (getline(&line, &len, fp) > 0) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (nf = 0, p = strtok(line, " \t\n"); p != NULL && nf < MAXFIELDS;
+		    p = strtok(NULL, " \t\n"))
+			f[nf++] = p;
+		if (nf == 0)
+			continue;
+		rules = realloc(rules, (nrules + 1) * sizeof(struct rule));
+		if (rules == NULL) {
+			perror(progname);
+			exit(1);
+		}
+		r = nrules++;
+		rp = &rules[r];
+		*rp = rules[0];
+		rp->ign = nf == 1;
+		for (i = 1; i < nf; i++) {
+			v = "";
+			if ((p = strchr(f[i], '=')) != NULL) {
+				*p = '\0';
+				v = p + 1;
+			}
+			if (strcmp(f[i], "ignore") == 0)
+				rp->ign = 1;
+			else if (strcmp(f[i], "g") == 0)
+				rp->g = clamp(ceil(strtod(v, NULL)));
+			else if (strcmp(f[i], "min") == 0)
+				rp->min = pages(v, 1);
+			else if (strcmp(f[i], "rate") == 0)
+				rp->rate = pages(v, 1);
+			else if (strcmp(f[i], "max") == 0)
+				rp->max = pages(v, 0);
+		}
+		if (strpbrk(f[0], "*?[") != NULL) {
+			pats = realloc(pats, (npats + 1) * sizeof(char *));
+			patrule = realloc(patrule, (npats + 1) * sizeof(int));
+			if (pats == NULL || patrule == NULL ||
+			    (pats[npats] = strdup(f[0])) == NULL) {
+				perror(progname);
+				exit(1);
+			}
+			patrule[npats++] = r;
+		} else if (find(exact, f[0], 0) == NULL)
+			find(exact, f[0], 1)->val = r;
+	}
+	free(line);
+	(void) fclose(fp);
+}
+
+/*
+ - policy - the rule of a process name, worked out once per name
+ */
+static int
+policy(char *name)
+{
+	struct ent *e;
+	int i;
+
+	if ((e = find(resolved, name, 0)) != NULL)
+		return e->val;
+	e = find(resolved, name, 1);
+	e->val = 0;
+	if (find(exact, name, 0) != NULL)
+		e->val = find(exact, name, 0)->val;
+	else
+		for (i = 0; i < npats; i++)
+			if (fnmatch(pats[i], name, 0) == 0) {
+				e->val = patrule[i];
+				break;
+			}
+	return e->val;
+}
+
+/*
+ - pages - a size in pages, or bytes with a K, M or G suffix; a fraction
+ - of a page rounds up for lower bounds and down for max=
+ */
+static int
+pages(char *x, int up)
+{
+	size_t n = strlen(x);
+	double v, m = 0;
+
+	if (n > 0)
+		switch (toupper((unsigned char) x[n - 1])) {
+		case 'K': m = 1024; break;
+		case 'M': m = 1048576; break;
+		case 'G': m = 1073741824; break;
+		}
+	v = strtod(x, NULL);
+	if (m == 0)
+		return clamp(up ? ceil(v) : floor(v));
+	return clamp(floor((v * m + pagesize - 1) / pagesize));
+}
+
+static int
+clamp(double v)
+{
+	return v < 0 ? 0 : v > INT_MAX ? INT_MAX : (int) v;
+}
+
+/*
+ - replay - run one snapshot, either 'ps -el' output or memmon records,
+ - through the detector
+ */
+static void
+replay(char *path, char *snap, long nsnap, long *nrec)
+{
+	FILE *fp;
+	char *line = NULL, *f[MAXFIELDS], *p, *pidf, *name;
+	size_t len = 0;
+	int nf, ps = -1, pos = 0, r, s, i, ne;
+	long pid;
+	double size;
+	struct timespec t0, t1;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return;
+	}
+	while (getline(&line, &len, fp) > 0) {
+		for (nf = 0, p = strtok(line, " \t\n"); p != NULL && nf < MAXFIELDS;
+		    p = strtok(NULL, " \t\n"))
+			f[nf++] = p;
+		if (ps < 0)
+			ps = nf >= 4 && strcmp(f[3], "PID") == 0;
+		if (ps) {
+			if (nf < 10)
+				continue;
+			pidf = f[3]; name = f[nf - 1]; size = strtod(f[9], NULL);
+		} else {
+			if (nf < 3)
+				continue;
+			pidf = f[0]; name = f[1]; size = strtod(f[2], NULL);
+		}
+		pid = strtol(pidf, &p, 10);
+		if (*p != '\0' || pid <= 0 || pid > INT_MAX)
+			continue;
+		if (rules[r = policy(name)].ign)
+			continue;
+		(*nrec)++;
+
+		/* a pid missing from the last snapshot is a new process */
+		s = slot((int) pid);
+		if (sseen[s] != nsnap - 1 || strcmp(sname[s], name) != 0) {
+			free(sname[s]);
+			if ((sname[s] = strdup(name)) == NULL) {
+				perror(progname);
+				exit(1);
+			}
+			cols.init[s] = clamp(size);
+			cols.grw[s] = 0;
+			cols.thr[s] = rules[r].g;
+			cols.rate[s] = rules[r].rate;
+			cols.min[s] = rules[r].min;
+			cols.max[s] = rules[r].max;
+			cols.live[s] = 0;
+		} else
+			cols.live[s] = -1;
+		cols.cur[s] = clamp(size);
+		cols.here[s] = -1;
+		sseen[s] = nsnap;
+		spos[s] = pos++;
+	}
+	free(line);
+	(void) fclose(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	growth_pass(&cols, nslots, &hits);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	kernsec += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	ne = 0;
+	for (i = 0; i < hits.ngrown; i++) {
+		events[ne].slot = hits.grown[i];
+		events[ne].pos = spos[hits.grown[i]];
+		events[ne++].kind = 0;
+	}
+	for (i = 0; i < hits.ncapped; i++) {
+		events[ne].slot = hits.capped[i];
+		events[ne].pos = spos[hits.capped[i]];
+		events[ne++].kind = 1;
+	}
+	if (ne > 1)
+		qsort(events, ne, sizeof(struct event), bypos);
+	for (i = 0; i < ne; i++)
+		alert(events[i].kind, events[i].slot, snap);
+	(void) memset(cols.here, 0, nslots * sizeof(int));
+	(void) memset(cols.live, 0, nslots * sizeof(int));
+}
+
+static int
+bypos(const void *a, const void *b)
+{
+	const struct event *x = a, *y = b;
+
+	if (x->pos != y->pos)
+		return x->pos < y->pos ? -1 : 1;
+	return x->kind - y->kind;
+}
+
+/*
+ - alert - count an alert for slot s, printing it the first time this
+ - pid and name raise that kind
+ */
+static void
+alert(int kind, int s, char *snap)
+{
+	char key[MAXKEY];
+
+	nalert++;
+	(void) snprintf(key, sizeof(key), "%d %s", spid[s], sname[s]);
+	if (find(kind ? capped : flagged, key, 0) != NULL)
+		return;
+	(void) find(kind ? capped : flagged, key, 1);
+	nflag++;
+	if (kind == 0)
+		(void) printf("%s: process <%d %s> has grown %d times, from %d pages to %d pages\n",
+		    snap, spid[s], sname[s], cols.grw[s], cols.init[s], cols.cur[s]);
+	else
+		(void) printf("%s: process <%d %s> is %d pages, over its limit of %d pages\n",
+		    snap, spid[s], sname[s], cols.cur[s], cols.max[s]);
+}
+
+/*
+ - slot - the slot of pid, a new one if it has none; pids are never
+ - removed, they are only reset when they come back
+ */
+static int
+slot(int pid)
+{
+	unsigned h;
+	int i, s, *old, oldsize;
+
+	if (2 * nslots >= pmask + 1) {
+		old = ptab;
+		oldsize = pmask + 1;
+		pmask = oldsize ? 2 * oldsize - 1 : 8191;
+		if ((ptab = calloc(pmask + 1, sizeof(int))) == NULL) {
+			perror(progname);
+			exit(1);
+		}
+		for (i = 0; i < oldsize; i++)
+			if (old[i] != 0) {
+				for (h = HASH(spid[old[i] - 1]); ptab[h] != 0;
+				    h = (h + 1) & pmask)
+					;
+				ptab[h] = old[i];
+			}
+		free(old);
+	}
+	for (h = HASH(pid); ptab[h] != 0; h = (h + 1) & pmask)
+		if (spid[ptab[h] - 1] == pid)
+			return ptab[h] - 1;
+	if (nslots == maxslots)
+		grow();
+	s = nslots++;
+	ptab[h] = s + 1;
+	spid[s] = pid;
+	sname[s] = NULL;
+	sseen[s] = -1;
+	return s;
+}
+
+/*
+ - grow - double the slots, keeping the hot columns aligned and padded
+ */
+static void
+grow()
+{
+	int n = maxslots ? 2 * maxslots : 4096;
+
+	cols.cur = column(cols.cur, n);
+	cols.prev = column(cols.prev, n);
+	cols.init = column(cols.init, n);
+	cols.grw = column(cols.grw, n);
+	cols.thr = column(cols.thr, n);
+	cols.rate = column(cols.rate, n);
+	cols.min = column(cols.min, n);
+	cols.max = column(cols.max, n);
+	cols.here = column(cols.here, n);
+	cols.live = column(cols.live, n);
+	spid = realloc(spid, n * sizeof(int));
+	sname = realloc(sname, n * sizeof(char *));
+	sseen = realloc(sseen, n * sizeof(int));
+	spos = realloc(spos, n * sizeof(int));
+	hits.grown = realloc(hits.grown, n * sizeof(int));
+	hits.capped = realloc(hits.capped, n * sizeof(int));
+	events = realloc(events, 2 * n * sizeof(struct event));
+	if (spid == NULL || sname == NULL || sseen == NULL || spos == NULL ||
+	    hits.grown == NULL || hits.capped == NULL || events == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	maxslots = n;
+}
+
+/*
+ - column - a zeroed, aligned copy of a column of maxslots ints with
+ - room for n
+ */
+static int *
+column(int *old, int n)
+{
+	int *c;
+
+	if ((c = aligned_alloc(ALIGN, n * sizeof(int))) == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	(void) memset(c, 0, n * sizeof(int));
+	if (old != NULL) {
+		(void) memcpy(c, old, maxslots * sizeof(int));
+		free(old);
+	}
+	return c;
+}
+
+/*
+ - find - the entry of key in table tab, added if create is set, else NULL
+ */
+static struct ent *
+find(struct ent **tab, char *key, int create)
+{
+	unsigned h = 0;
+	char *p;
+	struct ent *e;
+
+	for (p = key; *p; p++)
+		h = h * 31 + (unsigned char) *p;
+	h &= NBUCKETS - 1;
+	for (e = tab[h]; e != NULL; e = e->next)
+		if (strcmp(e->key, key) == 0)
+			return e;
+	if (!create)
+		return NULL;
+	if ((e = malloc(sizeof(struct ent) + strlen(key))) == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	(void) strcpy(e->key, key);
+	e->val = 0;
+	e->next = tab[h];
+	tab[h] = e;
+	return e;
+}
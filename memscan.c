@@ -0,0 +1,1418 @@
+/*
+ * memscan [-B sync|uring] [-C percent] [-e] [-i interval] [-n count]
+ *	[-o file] [-p] [-T budget] [-t filter]... [-v] -
+ * print the memory size of every process as memmon records, read
+ * straight from /proc; memscan -b count checks and times the parser.
+ * With -i and -C the reads of a cycle are spread over the interval in
+ * slices, within percent of one core.
+ */
+char ident[] = "@(#) memscan.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "procstat.h"
+
+#define	RESERVE_FDS	32	/* descriptors left for stdio and the shell */
+#define	BUFSZ		1024
+#define	NIL		(-1)
+#define	BATCH		128	/* processes per io_uring submission */
+#define	SYNC		0
+#define	URING		1
+#define	COMMSZ		64
+#define	MAXEVENTS	256
+#define	PSI_FILE	"/proc/pressure/memory"
+#define	PSI_TRIGGER	"some 150000 2000000"	/* 150ms of stalls in 2s */
+#define	PSI_EVENT	(~0ULL)		/* epoll data of the trigger */
+#define	TASK_BUDGET	4096	/* task entries walked a cycle with -t */
+#define	DENTSZ		8192
+#define	SLICE_NS	500000	/* CPU a slice of -C reads aims at */
+#define	SLICE_GAP	10000000	/* ns between slices, at least */
+
+/*
+ * The last record of a process, for its exit report and for -C to
+ * repeat while the process goes unread.
+ */
+struct last {
+	unsigned long size;	/* pages at the last sample */
+	unsigned long faults;	/* and the rest of its record, for -C */
+	pid_t	ppid;
+	long	threads;
+	unsigned long vsize;
+	char	comm[COMMSZ];
+};
+
+/*
+ * One cached process.  The descriptors stay bound to the process they
+ * were opened for: once it is reaped a read returns ESRCH, even if the
+ * pid has been reused, so the pair doubles as the process identity.
+ */
+struct proc {
+	pid_t	pid;		/* 0 while the slot is free */
+	int	statfd;		/* /proc/<pid>/stat */
+	int	statmfd;	/* /proc/<pid>/statm */
+	int	pidfd;		/* in the epoll set with -e, else -1 */
+	int	taskfd;		/* /proc/<pid>/task once walked, else -1 */
+	unsigned long gen;	/* last cycle the pid was listed */
+	struct last last;
+	int	hnext;		/* hash chain */
+	int	lprev, lnext;	/* LRU list, most recent first */
+};
+
+struct proc *procs;
+int *hash;
+int hmask;
+int ncache, maxcache;
+int lhead = NIL, ltail = NIL;
+int freelist = NIL;
+unsigned long gen;
+unsigned long nsys;		/* open/read/close calls this cycle */
+unsigned long nfiles;		/* /proc files sampled this cycle */
+char *progname;
+int backend = SYNC;
+int epfd = -1;			/* pidfd and pressure epoll set */
+int pidfds;			/* -e: hold a pidfd per cached process */
+int psifd = -1;			/* PSI_FILE with -p */
+int want = PS_FAULTS | PS_PPID;	/* the stat fields a record needs */
+double cpu;			/* -C: percent of a core for the reads */
+long long cost;			/* ns of CPU a process read, averaged */
+pid_t lastpid;			/* read last when -C left some unread */
+int coverage = 100;		/* percent of the processes read */
+int partial;			/* coverage was below 100 */
+
+/*
+ * With -C, the last records of the processes the cache has no slot for:
+ * those of this cycle, sorted by pid once it ends, and of the last one.
+ */
+struct held {
+	pid_t	pid;
+	struct last last;
+};
+
+struct held *held, *washeld;
+int nheld, nwasheld, maxheld, maxwasheld;
+
+/*
+ * A filter rule, as far as -t needs it: which names have their threads
+ * walked.  An exact name takes precedence over the patterns of its file,
+ * as in memmon; -t may be given once for each filter of a profile.
+ */
+struct trule {
+	char	*name;
+	int	pattern;
+	int	threads;
+	int	file;		/* which -t */
+};
+
+struct trule *trules;
+int ntrules, nthreaded, nfilters;
+long budget = TASK_BUDGET;	/* -T */
+long tasksleft;			/* of the budget, this cycle */
+char dents[DENTSZ];
+
+/*
+ * One process in an io_uring batch.  Each batch opens what the cache
+ * does not hold, reads everything and closes what it could not cache,
+ * one io_uring_enter per step instead of one system call per file.
+ */
+struct job {
+	pid_t	pid;
+	int	slot;		/* cache slot, or NIL */
+	int	fd[2];		/* stat, statm */
+	int	res[2];
+	char	path[2][32];
+	char	buf[2][BUFSZ];
+};
+
+struct job *jobs;
+pid_t *pids;
+int maxpids;
+
+extern int uring_init();
+extern struct io_uring_sqe *uring_sqe();
+extern int uring_wait();
+
+static void cache_init();
+static int cache_lookup();
+static int cache_insert();
+static void cache_evict();
+static void cache_touch();
+static void scan();
+static int scan_paced();
+static int list();
+static int bypid();
+static long long cputime();
+static void scan_uring();
+static void uring_done();
+static int sample();
+static int readfile();
+static void emit();
+static void remember();
+static struct last *hold();
+static int byheld();
+static void reemit();
+static void load_rules();
+static int threaded();
+static long tasks();
+static int wait_exits();
+static void psi_open();
+static long pace();
+static void benchmark();
+static int refstat();
+static int wellformed();
+
+/*
+ - main - parse arguments and run the sampling cycles
+ */
+int
+main(int argc, char *argv[])
+{
+	int c, errflg = 0, verbose = 0, paced = 0, woken, iflag = 0;
+	long interval = 0, count = -1, step = 0;
+	char *outfile = NULL, *tmpfile = NULL;
+	unsigned long cycle;
+	struct timespec next, t0, t1;
+	FILE *out;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, "B:b:C:ei:n:o:pT:t:v")) != EOF)
+		switch (c) {
+		case 'b':
+			benchmark(atol(optarg));
+			exit(0);
+		case 'B':
+			if (strcmp(optarg, "uring") == 0)
+				backend = URING;
+			else if (strcmp(optarg, "sync") != 0)
+				errflg++;
+			break;
+		case 'C':
+			if ((cpu = atof(optarg)) <= 0 || cpu > 100)
+				errflg++;
+			break;
+		case 'e':
+			pidfds++;
+			break;
+		case 'i':
+			interval = atol(optarg);
+			iflag++;
+			break;
+		case 'n':
+			if ((count = atol(optarg)) < 0)
+				errflg++;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'p':
+			paced++;
+			break;
+		case 'T':
+			budget = atol(optarg);
+			break;
+		case 't':
+			load_rules(optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case '?':
+		default:
+			errflg++;
+			break;
+		}
+	if (errflg || optind != argc || interval < 0 || budget < 0) {
+		(void) fprintf(stderr,
+		    "Usage: %s [-B sync|uring] [-C percent] [-e] [-i interval] [-n count] [-o file] [-p] [-T budget] [-t filter] [-v]\n"
+		    "       %s -b count\n", progname, progname);
+		exit(2);
+	}
+	/* one cycle, or with -i as many as -n says, forever without it */
+	if (count < 0)
+		count = iflag ? 0 : 1;
+	if (outfile != NULL) {
+		tmpfile = malloc(strlen(outfile) + 5);
+		if (tmpfile == NULL) {
+			perror(progname);
+			exit(1);
+		}
+		(void) sprintf(tmpfile, "%s.tmp", outfile);
+	}
+#ifndef __NR_pidfd_open
+	pidfds = 0;
+#endif
+	if (nthreaded)
+		want |= PS_THREADS | PS_VSIZE;
+	if (interval == 0) {
+		pidfds = paced = 0;
+		cpu = 0;
+	}
+	if ((pidfds || paced) && (epfd = epoll_create1(0)) < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	if (paced)
+		psi_open();
+	if (interval > 0)
+		cache_init();
+	if (backend == URING) {
+		jobs = malloc(BATCH * sizeof(struct job));
+		if (jobs == NULL || uring_init(2 * BATCH) < 0) {
+			if (verbose)
+				(void) fprintf(stderr,
+				    "%s: io_uring unavailable, using sync reads\n",
+				    progname);
+			backend = SYNC;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (cycle = 1; count == 0 || cycle <= count; cycle++) {
+		out = stdout;
+		if (tmpfile != NULL && (out = fopen(tmpfile, "w")) == NULL) {
+			perror(tmpfile);
+			exit(1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		woken = 0;
+		if (cpu > 0) {
+			/* the reads are spread over the step to the next cycle */
+			step = pace(interval);
+			woken = scan_paced(out, step);
+		} else
+			scan(out);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		/* a file is replaced whole, a stream gets a cycle marker */
+		if (tmpfile != NULL) {
+			if (fclose(out) == EOF || rename(tmpfile, outfile) < 0) {
+				perror(outfile);
+				exit(1);
+			}
+			if (interval > 0 && cpu > 0)
+				(void) printf("%lu %d\n", cycle, coverage);
+			else if (interval > 0)
+				(void) printf("%lu\n", cycle);
+		} else if (interval > 0)
+			(void) printf(".\n");
+		if (fflush(stdout) == EOF)
+			exit(1);
+
+		if (interval > 0 && cpu == 0)
+			step = pace(interval);
+		if (verbose && cpu > 0)
+			(void) fprintf(stderr,
+			    "%s: cycle %lu: %d%% of the processes read, at %lld ns of CPU each\n",
+			    progname, cycle, coverage, cost);
+		if (verbose)
+			(void) fprintf(stderr,
+			    "%s: cycle %lu: %lu files, %lu syscalls, %.2f per file, %d cached, %ld us, next in %ld s\n",
+			    progname, cycle, nfiles, nsys,
+			    nfiles ? (double) nsys / nfiles : 0.0, ncache,
+			    (t1.tv_sec - t0.tv_sec) * 1000000L +
+			    (t1.tv_nsec - t0.tv_nsec) / 1000, step);
+
+		if (interval > 0 && (count == 0 || cycle < count)) {
+			next.tv_sec += step;
+			/* a pressure trigger starts the next cycle at once */
+			if (woken)
+				clock_gettime(CLOCK_MONOTONIC, &next);
+			else if (epfd >= 0) {
+				if (wait_exits(&next))
+					clock_gettime(CLOCK_MONOTONIC, &next);
+			} else
+				while (clock_nanosleep(CLOCK_MONOTONIC,
+				    TIMER_ABSTIME, &next, NULL) == EINTR)
+					;
+		}
+	}
+	exit(0);
+}
+
+/*
+ * cache_init - size the descriptor cache from RLIMIT_NOFILE
+ */
+static void
+cache_init()
+{
+	struct rlimit rl;
+	int i;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void) setrlimit(RLIMIT_NOFILE, &rl);
+		(void) getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1048576)
+		rl.rlim_cur = 1048576;
+	maxcache = ((int) rl.rlim_cur - RESERVE_FDS) /
+	    ((pidfds ? 3 : 2) + (nthreaded ? 1 : 0));
+	if (maxcache <= 0) {
+		maxcache = 0;
+		return;
+	}
+
+	for (hmask = 1; hmask < maxcache * 2; hmask <<= 1)
+		;
+	procs = malloc(maxcache * sizeof(struct proc));
+	hash = malloc(hmask * sizeof(int));
+	if (procs == NULL || hash == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	hmask--;
+	for (i = 0; i <= hmask; i++)
+		hash[i] = NIL;
+	for (i = 0; i < maxcache; i++) {
+		procs[i].pid = 0;
+		procs[i].hnext = i + 1 < maxcache ? i + 1 : NIL;
+	}
+	freelist = 0;
+}
+
+/*
+ * cache_lookup - return the cache slot of pid, or NIL
+ */
+static int
+cache_lookup(pid_t pid)
+{
+	int i;
+
+	if (maxcache == 0)
+		return NIL;
+	for (i = hash[pid & hmask]; i != NIL; i = procs[i].hnext)
+		if (procs[i].pid == pid)
+			return i;
+	return NIL;
+}
+
+/*
+ * cache_insert - cache the descriptors of pid.  Only entries that were
+ * not listed in this cycle are evicted to make room, so a host with more
+ * processes than descriptors keeps a stable cached set instead of
+ * thrashing; NIL means the caller must close the descriptors itself.
+ */
+static int
+cache_insert(pid_t pid, int statfd, int statmfd)
+{
+	int i;
+
+	if (maxcache == 0)
+		return NIL;
+	if (freelist == NIL) {
+		if (ltail == NIL || procs[ltail].gen == gen)
+			return NIL;
+		cache_evict(ltail);
+	}
+	i = freelist;
+	freelist = procs[i].hnext;
+	procs[i].pid = pid;
+	procs[i].statfd = statfd;
+	procs[i].statmfd = statmfd;
+	procs[i].pidfd = -1;
+	procs[i].taskfd = -1;
+	procs[i].gen = gen;
+#ifdef __NR_pidfd_open
+	if (pidfds) {
+		struct epoll_event ev;
+
+		/* without a pidfd the exit is still found by the next scan */
+		procs[i].pidfd = (int) syscall(__NR_pidfd_open, pid, 0);
+		nsys += 2;
+		ev.events = EPOLLIN;
+		ev.data.u64 = (unsigned long long) i << 32 | (unsigned) pid;
+		if (procs[i].pidfd >= 0 &&
+		    epoll_ctl(epfd, EPOLL_CTL_ADD, procs[i].pidfd, &ev) < 0) {
+			(void) close(procs[i].pidfd);
+			procs[i].pidfd = -1;
+		}
+	}
+#endif
+	procs[i].hnext = hash[pid & hmask];
+	hash[pid & hmask] = i;
+	procs[i].lprev = NIL;
+	procs[i].lnext = lhead;
+	if (lhead != NIL)
+		procs[lhead].lprev = i;
+	lhead = i;
+	if (ltail == NIL)
+		ltail = i;
+	ncache++;
+	return i;
+}
+
+/*
+ * cache_evict - close the descriptors of slot i and free it
+ */
+static void
+cache_evict(int i)
+{
+	int *p;
+
+	(void) close(procs[i].statfd);
+	(void) close(procs[i].statmfd);
+	nsys += 2;
+	if (procs[i].pidfd >= 0) {
+		/* closing the last reference also leaves the epoll set */
+		(void) close(procs[i].pidfd);
+		nsys++;
+	}
+	if (procs[i].taskfd >= 0) {
+		(void) close(procs[i].taskfd);
+		nsys++;
+	}
+
+	for (p = &hash[procs[i].pid & hmask]; *p != i; p = &procs[*p].hnext)
+		;
+	*p = procs[i].hnext;
+	if (procs[i].lprev != NIL)
+		procs[procs[i].lprev].lnext = procs[i].lnext;
+	else
+		lhead = procs[i].lnext;
+	if (procs[i].lnext != NIL)
+		procs[procs[i].lnext].lprev = procs[i].lprev;
+	else
+		ltail = procs[i].lprev;
+	procs[i].pid = 0;
+	procs[i].hnext = freelist;
+	freelist = i;
+	ncache--;
+}
+
+/*
+ * cache_touch - mark slot i as listed in this cycle
+ */
+static void
+cache_touch(int i)
+{
+	procs[i].gen = gen;
+	if (i == lhead)
+		return;
+	procs[procs[i].lprev].lnext = procs[i].lnext;
+	if (procs[i].lnext != NIL)
+		procs[procs[i].lnext].lprev = procs[i].lprev;
+	else
+		ltail = procs[i].lprev;
+	procs[i].lprev = NIL;
+	procs[i].lnext = lhead;
+	procs[lhead].lprev = i;
+	lhead = i;
+}
+
+/*
+ * wait_exits - sleep until the deadline, reporting each tracked process
+ * as soon as its pidfd says it has exited: "X pid comm size".  Returns
+ * 1 if the pressure trigger cut the sleep short, else 0.
+ */
+static int
+wait_exits(struct timespec *deadline)
+{
+	struct epoll_event evs[MAXEVENTS];
+	struct timespec now;
+	long ms;
+	int i, n, slot, woken = 0;
+	pid_t pid;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (deadline->tv_sec - now.tv_sec) * 1000L +
+		    (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+		if (ms <= 0 || woken)
+			return woken;
+		if ((n = epoll_wait(epfd, evs, MAXEVENTS, (int) ms)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		for (i = 0; i < n; i++) {
+			if (evs[i].data.u64 == PSI_EVENT) {
+				woken = 1;
+				continue;
+			}
+			slot = (int) (evs[i].data.u64 >> 32);
+			pid = (pid_t) (evs[i].data.u64 & 0xffffffff);
+			if (procs[slot].pid != pid)
+				continue;
+			(void) printf("X %d %s %lu\n", (int) pid,
+			    procs[slot].last.comm, procs[slot].last.size);
+			cache_evict(slot);
+		}
+		if (n > 0 && fflush(stdout) == EOF)
+			exit(1);
+	}
+}
+
+/*
+ * psi_open - open PSI_FILE and arm a trigger on it that wakes the daemon
+ * when tasks stall on memory.  Unprivileged triggers need a 2s window
+ * and a recent kernel; without one the stall totals still pace the
+ * cycles, and without PSI at all the interval is fixed.
+ */
+static void
+psi_open()
+{
+	struct epoll_event ev;
+
+	if ((psifd = open(PSI_FILE, O_RDWR | O_NONBLOCK)) < 0 &&
+	    (psifd = open(PSI_FILE, O_RDONLY)) < 0)
+		return;
+	if (write(psifd, PSI_TRIGGER, sizeof(PSI_TRIGGER)) < 0)
+		return;
+	ev.events = EPOLLPRI;
+	ev.data.u64 = PSI_EVENT;
+	(void) epoll_ctl(epfd, EPOLL_CTL_ADD, psifd, &ev);
+}
+
+/*
+ * pace - seconds to the next cycle with -p: twice the interval when no
+ * task has stalled on memory since the last cycle, half of it when they
+ * have stalled for 1% of the time or more, else the interval itself
+ */
+static long
+pace(long interval)
+{
+	static unsigned long long last;
+	static struct timespec then;
+	unsigned long long total;
+	struct timespec now;
+	double elapsed, stalled;
+	char buf[BUFSZ], *p;
+	ssize_t n;
+
+	if (psifd < 0 || (n = pread(psifd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return interval;
+	buf[n] = '\0';
+	if (strncmp(buf, "some ", 5) != 0 || (p = strstr(buf, "total=")) == NULL)
+		return interval;
+	total = strtoull(p + 6, NULL, 10);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - then.tv_sec) * 1e6 +
+	    (now.tv_nsec - then.tv_nsec) / 1e3;
+	stalled = then.tv_sec ? (total - last) / elapsed : -1;
+	last = total;
+	then = now;
+	if (stalled == 0)
+		return 2 * interval;
+	if (stalled >= 0.01)
+		return interval > 1 ? interval / 2 : 1;
+	return interval;
+}
+
+/*
+ * scan - write one record for every process in /proc
+ */
+static void
+scan(FILE *out)
+{
+	DIR *dp;
+	struct dirent *de;
+
+	gen++;
+	nsys = nfiles = 0;
+	tasksleft = budget;
+	if (backend == URING)
+		scan_uring(pids, list(), out);
+	else {
+		if ((dp = opendir("/proc")) == NULL) {
+			perror("/proc");
+			exit(1);
+		}
+		while ((de = readdir(dp)) != NULL)
+			if (isdigit((unsigned char) de->d_name[0]))
+				(void) sample((pid_t) atol(de->d_name), out);
+		(void) closedir(dp);
+	}
+
+	/* whatever was not listed has exited */
+	while (ltail != NIL && procs[ltail].gen != gen)
+		cache_evict(ltail);
+}
+
+/*
+ * list - read the pids in /proc into pids; returns how many
+ */
+static int
+list()
+{
+	DIR *dp;
+	struct dirent *de;
+	int npids = 0;
+
+	if ((dp = opendir("/proc")) == NULL) {
+		perror("/proc");
+		exit(1);
+	}
+	while ((de = readdir(dp)) != NULL) {
+		if (!isdigit((unsigned char) de->d_name[0]))
+			continue;
+		if (npids == maxpids) {
+			maxpids = maxpids ? maxpids * 2 : 1024;
+			if ((pids = realloc(pids, maxpids * sizeof(pid_t))) == NULL) {
+				perror(progname);
+				exit(1);
+			}
+		}
+		pids[npids++] = (pid_t) atol(de->d_name);
+	}
+	(void) closedir(dp);
+	return npids;
+}
+
+static int
+bypid(const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *) a, y = *(const pid_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * scan_paced - with -C, list the processes and read them in slices
+ * spread over the step seconds to the next cycle, as many as the CPU
+ * budget of the step leaves room for at the cost a read has been
+ * measured at, each slice taking about SLICE_NS of it.  When the budget
+ * falls short the reads start after the last pid read the cycle before,
+ * and the processes left unread repeat their last record, from the cache
+ * or, without a slot, from held.  Returns 1 if the pressure trigger cut
+ * the cycle short.
+ */
+static int
+scan_paced(FILE *out, long step)
+{
+	struct timespec start, at;
+	struct held key, *h, *th;
+	struct last *l;
+	long long c0, ns, allowed, span = step * 1000000000LL;
+	int npids, nread, first, k, nslices, s, done, n, i, woken = 0;
+	pid_t t;
+
+	gen++;
+	th = washeld, washeld = held, held = th;
+	n = maxwasheld, maxwasheld = maxheld, maxheld = n;
+	nwasheld = nheld;
+	nheld = 0;
+	nsys = nfiles = 0;
+	tasksleft = budget;
+	c0 = cputime();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	npids = list();
+	qsort(pids, npids, sizeof(pid_t), bypid);
+
+	/* what the step allows, less what the listing took */
+	ns = (long long) (span * cpu / 100) - (cputime() - c0);
+	allowed = cost > 0 ? ns / cost : npids;
+	nread = allowed >= npids ? npids : allowed > 0 ? (int) allowed : 1;
+	if (nread < npids) {
+		for (first = 0; first < npids && pids[first] <= lastpid; first++)
+			;
+		if (first == npids)
+			first = 0;
+		/* rotate pids left by first, in three reversals */
+#define	REVERSE(p, n)	for (i = 0; i < (n) / 2; i++) { t = (p)[i]; \
+			    (p)[i] = (p)[(n) - 1 - i]; (p)[(n) - 1 - i] = t; }
+		REVERSE(pids, first);
+		REVERSE(pids + first, npids - first);
+		REVERSE(pids, npids);
+#undef	REVERSE
+		lastpid = pids[nread - 1];
+	} else
+		lastpid = 0;
+
+	/* first, so that the reads cannot evict the slots of the rest */
+	for (i = nread; i < npids; i++)
+		if ((k = cache_lookup(pids[i])) != NIL) {
+			cache_touch(k);
+			reemit(pids[i], &procs[k].last, out);
+		} else {
+			key.pid = pids[i];
+			if ((h = bsearch(&key, washeld, nwasheld, sizeof(*h),
+			    byheld)) == NULL)
+				continue;
+			reemit(h->pid, &h->last, out);
+			if ((l = hold(h->pid)) != NULL)
+				*l = h->last;
+		}
+
+	k = cost > 0 ? (int) (SLICE_NS / cost) : 16;
+	if (k < 1)
+		k = 1;
+	nslices = (nread + k - 1) / k;
+	if (nslices > span / SLICE_GAP) {
+		nslices = span / SLICE_GAP;
+		k = (nread + nslices - 1) / nslices;
+	}
+	for (s = done = 0; done < nread; s++) {
+		if (s > 0 && !woken) {
+			ns = span * s / nslices + start.tv_nsec;
+			at.tv_sec = start.tv_sec + ns / 1000000000;
+			at.tv_nsec = ns % 1000000000;
+			if (epfd >= 0)
+				woken = wait_exits(&at);
+			else
+				while (clock_nanosleep(CLOCK_MONOTONIC,
+				    TIMER_ABSTIME, &at, NULL) == EINTR)
+					;
+		}
+		n = nread - done < k ? nread - done : k;
+		c0 = cputime();
+		if (backend == URING)
+			scan_uring(pids + done, n, out);
+		else
+			for (i = 0; i < n; i++)
+				(void) sample(pids[done + i], out);
+		ns = (cputime() - c0) / n;
+		cost = cost > 0 ? (cost + ns) / 2 : ns > 0 ? ns : 1;
+		done += n;
+	}
+	qsort(held, nheld, sizeof(*held), byheld);
+
+	/* whatever was not listed has exited */
+	while (ltail != NIL && procs[ltail].gen != gen)
+		cache_evict(ltail);
+
+	coverage = npids > 0 ? (int) (nread * 100LL / npids) : 100;
+	if ((nread < npids) != partial) {
+		partial = nread < npids;
+		if (partial)
+			(void) fprintf(stderr,
+			    "%s: the CPU budget reads %d of %d processes a cycle\n",
+			    progname, nread, npids);
+		else
+			(void) fprintf(stderr,
+			    "%s: the CPU budget reads every process again\n",
+			    progname);
+	}
+	return woken;
+}
+
+/*
+ * cputime - ns of CPU this process has used
+ */
+static long long
+cputime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * scan_uring - sample the npids pids of list in io_uring batches
+ */
+static void
+scan_uring(pid_t *list, int npids, FILE *out)
+{
+	struct io_uring_sqe *sqe;
+	struct job *jp;
+	struct pstat r;
+	int base, nb, j, k, n;
+
+	for (base = 0; base < npids; base += BATCH) {
+		nb = npids - base < BATCH ? npids - base : BATCH;
+
+		/* open what the cache does not hold */
+		for (j = 0; j < nb; j++) {
+			jp = &jobs[j];
+			jp->pid = list[base + j];
+			if ((jp->slot = cache_lookup(jp->pid)) != NIL) {
+				cache_touch(jp->slot);
+				jp->fd[0] = procs[jp->slot].statfd;
+				jp->fd[1] = procs[jp->slot].statmfd;
+				continue;
+			}
+			(void) sprintf(jp->path[0], "/proc/%d/stat", (int) jp->pid);
+			(void) sprintf(jp->path[1], "/proc/%d/statm", (int) jp->pid);
+			for (k = 0; k < 2; k++) {
+				sqe = uring_sqe();
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = AT_FDCWD;
+				sqe->addr = (unsigned long) jp->path[k];
+				sqe->open_flags = O_RDONLY;
+				sqe->user_data = j * 2 + k;
+			}
+		}
+		if ((n = uring_wait(uring_done)) < 0)
+			goto fail;
+		nsys += n;
+		for (j = 0; j < nb; j++) {
+			jp = &jobs[j];
+			if (jp->slot == NIL)
+				for (k = 0; k < 2; k++)
+					jp->fd[k] = jp->res[k];
+		}
+
+		/* read everything that is open */
+		for (j = 0; j < nb; j++) {
+			jp = &jobs[j];
+			for (k = 0; k < 2; k++) {
+				jp->res[k] = -EBADF;
+				if (jp->fd[k] < 0)
+					continue;
+				sqe = uring_sqe();
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = jp->fd[k];
+				sqe->addr = (unsigned long) jp->buf[k];
+				sqe->len = BUFSZ - 1;
+				sqe->off = 0;
+				sqe->user_data = j * 2 + k;
+			}
+		}
+		if ((n = uring_wait(uring_done)) < 0)
+			goto fail;
+		nsys += n;
+		nfiles += 2 * nb;
+
+		/* print, then cache or close */
+		for (j = 0; j < nb; j++) {
+			jp = &jobs[j];
+			if (jp->res[0] >= 0 && jp->res[1] >= 0) {
+				jp->buf[0][jp->res[0]] = '\0';
+				jp->buf[1][jp->res[1]] = '\0';
+				if (procstat(jp->buf[0], jp->buf[1], &r, want) == 0)
+					emit(jp->pid, jp->slot, &r, out);
+				else if (jp->slot != NIL) {
+					cache_evict(jp->slot);
+					continue;
+				} else
+					r.state = 'Z';	/* not worth caching */
+				if (jp->slot != NIL) {
+					remember(jp->slot, jp->pid, &r);
+					continue;
+				}
+				if (r.state != 'Z' && r.state != 'X') {
+					k = cache_insert(jp->pid, jp->fd[0],
+					    jp->fd[1]);
+					remember(k, jp->pid, &r);
+					if (k != NIL)
+						continue;
+				}
+			} else if (jp->slot != NIL) {
+				/* reaped; a new process under this pid is reopened */
+				cache_evict(jp->slot);
+				if (jp->res[0] == -ESRCH || jp->res[1] == -ESRCH)
+					(void) sample(jp->pid, out);
+				continue;
+			}
+			for (k = 0; k < 2; k++) {
+				if (jp->fd[k] < 0)
+					continue;
+				sqe = uring_sqe();
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = jp->fd[k];
+				sqe->user_data = j * 2 + k;
+			}
+		}
+		if ((n = uring_wait(uring_done)) < 0)
+			goto fail;
+		nsys += n;
+	}
+	return;
+
+fail:
+	perror("io_uring_enter");
+	exit(1);
+}
+
+/*
+ * uring_done - record the result of one completed io_uring operation
+ */
+static void
+uring_done(unsigned long long data, int res)
+{
+	jobs[data >> 1].res[data & 1] = res;
+}
+
+/*
+ * sample - read stat and statm of pid, through the cache when possible
+ */
+static int
+sample(pid_t pid, FILE *out)
+{
+	char stat[BUFSZ], statm[BUFSZ], path[64];
+	struct pstat r;
+	int c, i, statfd, statmfd;
+
+	if ((i = cache_lookup(pid)) != NIL) {
+		cache_touch(i);
+		nfiles += 2;
+		nsys += 2;
+		if (readfile(procs[i].statfd, stat) < 0 ||
+		    readfile(procs[i].statmfd, statm) < 0) {
+			/* reaped; a new process under this pid is reopened */
+			c = errno;
+			cache_evict(i);
+			if (c != ESRCH)
+				return -1;
+		} else {
+			if (procstat(stat, statm, &r, want) < 0) {
+				cache_evict(i);
+				return -1;
+			}
+			emit(pid, i, &r, out);
+			remember(i, pid, &r);
+			return 0;
+		}
+	}
+
+	(void) sprintf(path, "/proc/%d/stat", (int) pid);
+	nfiles += 2;
+	nsys += 2;
+	if ((statfd = open(path, O_RDONLY)) < 0)
+		return -1;
+	(void) strcat(path, "m");
+	if ((statmfd = open(path, O_RDONLY)) < 0) {
+		(void) close(statfd);
+		nsys++;
+		return -1;
+	}
+	nsys += 2;
+	if (readfile(statfd, stat) < 0 || readfile(statmfd, statm) < 0) {
+		(void) close(statfd);
+		(void) close(statmfd);
+		nsys += 2;
+		return -1;
+	}
+	if (procstat(stat, statm, &r, want) < 0)
+		r.state = 'Z';
+	else
+		emit(pid, NIL, &r, out);
+
+	/* zombies are not cached, their pidfd would fire straight away */
+	if (r.state == 'Z' || r.state == 'X')
+		i = NIL;
+	else
+		remember(i = cache_insert(pid, statfd, statmfd), pid, &r);
+	if (i == NIL) {
+		(void) close(statfd);
+		(void) close(statmfd);
+		nsys += 2;
+	}
+	return 0;
+}
+
+/*
+ * readfile - pread a whole /proc file from offset 0 into buf
+ */
+static int
+readfile(int fd, char *buf)
+{
+	ssize_t n;
+
+	if ((n = pread(fd, buf, BUFSZ - 1, (off_t) 0)) < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+/*
+ * emit - print the memmon record "pid comm size isize growth faults ppid";
+ * with -t a process of a threads rule adds "threads vsize", the number
+ * of its tasks and its address space in kB
+ */
+static void
+emit(pid_t pid, int slot, struct pstat *r, FILE *out)
+{
+	long n;
+
+	(void) fprintf(out, "%d %s %lu %lu 0 %lu %d", (int) pid, r->comm,
+	    r->size, r->size, r->minflt + r->majflt, r->ppid);
+	if (nthreaded && threaded(r->comm)) {
+		if ((n = tasks(pid, slot)) <= 0)
+			n = r->threads;
+		(void) fprintf(out, " %ld %lu", n, r->vsize / 1024);
+	}
+	(void) putc('\n', out);
+}
+
+/*
+ * tasks - count the tasks of pid by walking /proc/<pid>/task, keeping the
+ * directory open in cache slot i, if any, for the next cycle.  Returns 0
+ * once the cycle has walked its budget of entries, or -1; the caller then
+ * falls back to the thread count in stat.
+ */
+static long
+tasks(pid_t pid, int i)
+{
+	char path[32], *name;
+	int fd, n, off;
+	unsigned short reclen;
+	long count = 0;
+
+	if (tasksleft <= 0)
+		return 0;
+	if (i != NIL && (fd = procs[i].taskfd) >= 0) {
+		(void) lseek(fd, (off_t) 0, SEEK_SET);
+		nsys++;
+	} else {
+		(void) sprintf(path, "/proc/%d/task", (int) pid);
+		nsys++;
+		if ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0)
+			return -1;
+	}
+	nfiles++;
+	while ((n = syscall(SYS_getdents64, fd, dents, DENTSZ)) > 0) {
+		nsys++;
+		for (off = 0; off < n; off += reclen) {
+			/* struct linux_dirent64: ino, off, reclen, type, name */
+			(void) memcpy(&reclen, dents + off + 16, sizeof(reclen));
+			name = dents + off + 19;
+			if (isdigit((unsigned char) *name))
+				count++;
+		}
+	}
+	nsys++;
+	tasksleft -= count;
+	if (i != NIL)
+		procs[i].taskfd = fd;
+	else {
+		(void) close(fd);
+		nsys++;
+	}
+	return count;
+}
+
+/*
+ * load_rules - read which names of a memfilt file have the threads
+ * setting; memmon goes on without a filter file, and so does memscan
+ */
+static void
+load_rules(char *path)
+{
+	FILE *fp;
+	char line[BUFSZ], *f, *p;
+	struct trule *t;
+	int nf;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		if ((f = strtok(line, " \t\n")) == NULL)
+			continue;
+		if ((t = realloc(trules, (ntrules + 1) * sizeof(*t))) == NULL ||
+		    (t[ntrules].name = strdup(f)) == NULL) {
+			perror(progname);
+			exit(1);
+		}
+		trules = t;
+		t = &trules[ntrules++];
+		t->pattern = strpbrk(f, "*?[") != NULL;
+		t->threads = 0;
+		t->file = nfilters;
+		for (nf = 1; (p = strtok(NULL, " \t\n")) != NULL; nf++)
+			if (strcmp(p, "ignore") == 0)
+				t->threads = -1;
+			else if (strcmp(p, "threads") == 0 && t->threads == 0)
+				t->threads = 1;
+		/* a name on its own is ignored */
+		if (nf == 1 || t->threads < 0)
+			t->threads = 0;
+		nthreaded += t->threads;
+	}
+	(void) fclose(fp);
+	nfilters++;
+}
+
+/*
+ * threaded - whether the rule of a process name has the threads setting
+ * in any of the filters
+ */
+static int
+threaded(char *comm)
+{
+	int f, i, r;
+
+	for (f = 0; f < nfilters; f++) {
+		r = NIL;
+		for (i = 0; i < ntrules && r == NIL; i++)
+			if (trules[i].file == f && !trules[i].pattern &&
+			    strcmp(trules[i].name, comm) == 0)
+				r = i;
+		for (i = 0; i < ntrules && r == NIL; i++)
+			if (trules[i].file == f && trules[i].pattern &&
+			    fnmatch(trules[i].name, comm, 0) == 0)
+				r = i;
+		if (r != NIL && trules[r].threads)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * remember - keep what an exit report needs in cache slot i, or with -C
+ * what reemit needs in held when pid has no slot
+ */
+static void
+remember(int i, pid_t pid, struct pstat *r)
+{
+	struct last *l;
+
+	if (i != NIL)
+		l = &procs[i].last;
+	else if (cpu == 0 || (l = hold(pid)) == NULL)
+		return;
+	l->size = r->size;
+	if (cpu > 0) {
+		l->faults = r->minflt + r->majflt;
+		l->ppid = r->ppid;
+		l->threads = nthreaded && threaded(r->comm) ? r->threads : 0;
+		l->vsize = r->vsize / 1024;
+	}
+	(void) strncpy(l->comm, r->comm, COMMSZ - 1);
+	l->comm[COMMSZ - 1] = '\0';
+}
+
+/*
+ * hold - add pid to held, growing it as needed; NULL if there is no
+ * room, and pid then reads as exited should -C leave it unread
+ */
+static struct last *
+hold(pid_t pid)
+{
+	struct held *h;
+
+	if (nheld == maxheld) {
+		h = realloc(held, (maxheld + 1024) * sizeof(*h));
+		if (h == NULL)
+			return NULL;
+		held = h;
+		maxheld += 1024;
+	}
+	h = &held[nheld++];
+	h->pid = pid;
+	return &h->last;
+}
+
+static int
+byheld(const void *a, const void *b)
+{
+	return bypid(&((const struct held *) a)->pid,
+	    &((const struct held *) b)->pid);
+}
+
+/*
+ * reemit - print the last record of pid again, for a process that -C
+ * left unread this cycle
+ */
+static void
+reemit(pid_t pid, struct last *l, FILE *out)
+{
+	(void) fprintf(out, "%d %s %lu %lu 0 %lu %d", (int) pid, l->comm,
+	    l->size, l->size, l->faults, (int) l->ppid);
+	if (l->threads > 0)
+		(void) fprintf(out, " %ld %lu", l->threads, l->vsize);
+	(void) putc('\n', out);
+}
+
+/*
+ * Records that defeat a parser splitting stat on blanks or on the first
+ * ')': comm is up to 15 bytes of anything but NUL.
+ */
+static char *hostile[] = {
+	"a b", "x) (y", ")", "((", "1 2 3", ") S 1 2", "", "))))))))))))))",
+	"\t\n", "0", "-1", "a)b)c)",
+};
+
+#define	MUTATIONS	64
+#define	MAXCORPUS	65536
+
+/*
+ - benchmark - check procstat() against a sscanf reference on every live
+ - process, on hostile comm names and on truncated and mutated copies of
+ - them, then time count passes of each over the same records
+ */
+static void
+benchmark(long count)
+{
+	char (*stat)[BUFSZ], (*statm)[BUFSZ];
+	char path[64], a[BUFSZ], b[BUFSZ], c[BUFSZ], am[BUFSZ], bm[BUFSZ], *end;
+	struct pstat x, y;
+	struct timespec t0, t1;
+	DIR *dp;
+	struct dirent *de;
+	int n = 0, real, i, j, k, fd, fd2, ra, rb, len;
+	long fuzzed = 0, differ = 0, rejected = 0;
+	static int want[] = { PS_ALL, PS_ALL, PS_FAULTS, 0 };
+	double ns[5];
+	long l;
+
+	stat = malloc(MAXCORPUS * sizeof(*stat));
+	statm = malloc(MAXCORPUS * sizeof(*statm));
+	if (stat == NULL || statm == NULL) {
+		perror(progname);
+		exit(1);
+	}
+	if ((dp = opendir("/proc")) == NULL) {
+		perror("/proc");
+		exit(1);
+	}
+	while ((de = readdir(dp)) != NULL && n < MAXCORPUS - 16) {
+		/* leave room for the m of statm */
+		if (!isdigit((unsigned char) de->d_name[0]) ||
+		    snprintf(path, sizeof(path) - 1, "/proc/%s/stat",
+		    de->d_name) >= sizeof(path) - 1)
+			continue;
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		(void) strcat(path, "m");
+		if ((fd2 = open(path, O_RDONLY)) >= 0 &&
+		    readfile(fd, stat[n]) == 0 && readfile(fd2, statm[n]) == 0)
+			n++;
+		(void) close(fd);
+		if (fd2 >= 0)
+			(void) close(fd2);
+	}
+	(void) closedir(dp);
+	if (n == 0) {
+		(void) fprintf(stderr, "%s: no processes to sample\n", progname);
+		exit(1);
+	}
+	real = n;
+	for (i = 0; i < sizeof(hostile) / sizeof(hostile[0]); i++) {
+		end = strrchr(stat[0], ')');
+		(void) snprintf(stat[n], BUFSZ, "1 (%s%s", hostile[i], end);
+		(void) strcpy(statm[n++], statm[0]);
+	}
+
+	/* every record as it is, then cut short and scrambled */
+	srand(1);
+	for (i = 0; i < n; i++) {
+		len = strlen(stat[i]);
+		for (j = -1; j <= len + MUTATIONS; j++) {
+			(void) strcpy(a, stat[i]);
+			(void) strcpy(am, statm[i]);
+			if (j >= 0 && j < len)
+				a[j] = '\0';
+			else if (j > len)
+				for (k = rand() % 4; k >= 0; k--)
+					a[rand() % len] = " ()0123456789\n-x"[rand() % 16];
+			(void) strcpy(b, a);
+			(void) strcpy(c, a);
+			(void) strcpy(bm, am);
+			(void) memset(&x, 0, sizeof(x));
+			(void) memset(&y, 0, sizeof(y));
+			ra = procstat(a, am, &x, PS_ALL);
+			rb = refstat(b, bm, &y);
+			fuzzed++;
+			if (ra < 0)
+				rejected++;
+			if (ra == 0 && rb == 0 && wellformed(c) &&
+			    (strcmp(x.comm, y.comm) != 0 ||
+			    x.state != y.state || x.ppid != y.ppid ||
+			    x.minflt != y.minflt || x.majflt != y.majflt ||
+			    x.threads != y.threads || x.start != y.start || x.vsize != y.vsize ||
+			    x.rss != y.rss || x.size != y.size ||
+			    x.resident != y.resident)) {
+				differ++;
+				if (j < 0)
+					(void) fprintf(stderr, "%s: record %d: %s\n",
+					    progname, i, stat[i]);
+			} else if (j < 0 && ra < 0)
+				(void) fprintf(stderr, "%s: rejected record %d: %s\n",
+				    progname, i, stat[i]);
+		}
+	}
+
+	/* everything, the reference, what memscan reads, and sizes alone */
+	for (k = 0; k < 4; k++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (l = 0; l < count; l++)
+			for (i = 0; i < n; i++) {
+				(void) memcpy(a, stat[i], BUFSZ);
+				if (k == 1)
+					(void) refstat(a, statm[i], &x);
+				else
+					(void) procstat(a, statm[i], &x, want[k]);
+			}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns[k] = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+		    (t1.tv_nsec - t0.tv_nsec)) / ((double) count * n);
+	}
+
+	/* what memmon adds for each candidate: its high-water marks */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (l = 0; l < count; l++)
+		if ((fd = open("/proc/self/status", O_RDONLY)) >= 0) {
+			if (readfile(fd, a) == 0 && (end = strstr(a, "VmPeak:")) != NULL)
+				x.vsize = strtoul(end + 7, NULL, 10);
+			(void) close(fd);
+		}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns[4] = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+	    (t1.tv_nsec - t0.tv_nsec)) / count;
+
+	(void) printf("%d records (%d live), %ld checked, %ld rejected, %ld differ from sscanf\n",
+	    n, real, fuzzed, rejected, differ);
+	(void) printf("procstat %.2f M records/s, sscanf %.2f M records/s\n",
+	    1e3 / ns[0], 1e3 / ns[1]);
+	(void) printf("sizes %.0f ns a record, with faults %.0f ns; status %.1f us a candidate\n",
+	    ns[3], ns[2], ns[4] / 1e3);
+	free(stat);
+	free(statm);
+}
+
+/*
+ - refstat - the obvious parser, for benchmark to check procstat against
+ */
+static int
+refstat(char *stat, char *statm, struct pstat *ps)
+{
+	char *comm, *end, *p, state;
+
+	if ((comm = strchr(stat, '(')) == NULL ||
+	    (end = strrchr(stat, ')')) == NULL || end < comm || end[1] == '\0')
+		return -1;
+	*end = '\0';
+	for (p = ++comm; *p; p++)
+		if (isspace((unsigned char) *p))
+			*p = '_';
+	ps->comm = comm;
+	if (sscanf(end + 2, "%c %d %*d %*d %*d %*d %*u %lu %*u %lu %*u %*u %*u "
+	    "%*d %*d %*d %*d %ld %*d %llu %lu %lu", &state, &ps->ppid,
+	    &ps->minflt, &ps->majflt, &ps->threads, &ps->start, &ps->vsize,
+	    &ps->rss) != 8 ||
+	    sscanf(statm, "%lu %lu", &ps->size, &ps->resident) != 2)
+		return -1;
+	ps->state = (unsigned char) state;
+	return 0;
+}
+
+/*
+ - wellformed - whether a record the kernel could have written: a state
+ - and then numbers that fit in 64 bits, one blank apart
+ */
+static int
+wellformed(char *stat)
+{
+	char *p;
+	int digits;
+
+	if ((p = strrchr(stat, ')')) == NULL || p[1] != ' ' || p[2] == '\0' ||
+	    p[3] != ' ')
+		return 0;
+	for (p += 4; *p && *p != '\n'; p++) {
+		if (*p == '-')
+			p++;
+		for (digits = 0; isdigit((unsigned char) *p); p++)
+			digits++;
+		if (digits == 0 || digits > 19 || (*p != ' ' && *p != '\n'))
+			return 0;
+		if (*p == '\n')
+			return p[1] == '\0';
+	}
+	return 0;
+}
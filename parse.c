@@ -854,8 +854,207 @@ static int mdays[12] =
 #define epoch 1970
 
 extern struct tm *localtime();
+extern char *getenv();
 static time_t timeconv();
 
+/*
+ * The local zone, cached.  localtime() takes the libc time zone lock
+ * and revisits TZ on every call, while the offset from UTC changes
+ * only a couple of times a year.  So each day asked about is looked at
+ * with localtime() once, at its two ends, a transition inside it is
+ * found by bisection, and the result is kept as a sorted table of
+ * spans of constant offset; after that zonetime() is a binary search
+ * and some calendar arithmetic.  The table holds for the TZ it was
+ * built under and is flushed when TZ changes.
+ */
+#define MAXSPAN	512
+#define TZSZ	256
+
+static struct span {
+	time_t	start, end;		/* covers [start, end) */
+	long	off;			/* seconds east of UTC */
+	int	isdst;
+} spans[MAXSPAN];
+static int nspans;
+static int zoneset = -1;		/* TZ of the table: -1 none yet, 0 unset */
+static char zonetz[TZSZ];
+
+/*
+ - dayno - days from 1970-01-01 to y/m/d of the proleptic Gregorian calendar
+ */
+static long
+dayno(y, m, d)
+long y; int m, d;
+{
+	long era, yoe, doy;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	return (era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468);
+}
+
+/*
+ - zoneoff - the UTC offset at t, the slow way
+ */
+static long
+zoneoff(t, isdst)
+time_t t; int *isdst;
+{
+	register struct tm *lt;
+
+	lt = localtime(&t);
+	*isdst = lt->tm_isdst > 0;
+	return (dayno(lt->tm_year + 1900L, lt->tm_mon + 1, lt->tm_mday) * daysec +
+	    lt->tm_hour * 3600L + lt->tm_min * 60L + lt->tm_sec - t);
+}
+
+/*
+ - addspan - record [start, end) at offset off, merging with a neighbour
+ */
+static void
+addspan(start, end, off, isdst)
+time_t start, end; long off; int isdst;
+{
+	register int i;
+
+	/* a full table gives up the span farthest from the new one */
+	if (nspans == MAXSPAN) {
+		if (start - spans[0].start > spans[nspans-1].start - start)
+			(void) memmove(&spans[0], &spans[1],
+			    (nspans - 1) * sizeof(spans[0]));
+		nspans--;
+	}
+	for (i = nspans; i > 0 && spans[i-1].start > start; i--)
+		;
+	if (i > 0 && spans[i-1].end == start && spans[i-1].off == off &&
+	    spans[i-1].isdst == isdst) {
+		spans[i-1].end = end;
+		if (i < nspans && spans[i].start == end &&
+		    spans[i].off == off && spans[i].isdst == isdst) {
+			spans[i-1].end = spans[i].end;
+			(void) memmove(&spans[i], &spans[i+1],
+			    (nspans - i - 1) * sizeof(spans[0]));
+			nspans--;
+		}
+		return;
+	}
+	if (i < nspans && spans[i].start == end && spans[i].off == off &&
+	    spans[i].isdst == isdst) {
+		spans[i].start = start;
+		return;
+	}
+	(void) memmove(&spans[i+1], &spans[i], (nspans - i) * sizeof(spans[0]));
+	spans[i].start = start;
+	spans[i].end = end;
+	spans[i].off = off;
+	spans[i].isdst = isdst;
+	nspans++;
+}
+
+/*
+ - zonecheck - flush the spans if TZ is not what they were worked out for
+ */
+static void
+zonecheck()
+{
+	register char *tz = getenv("TZ");
+
+	if (tz == NULL ? zoneset == 0 :
+	    zoneset == 1 && strcmp(tz, zonetz) == 0)
+		return;
+	nspans = 0;
+	/* a TZ too long to keep is looked at afresh every time */
+	zoneset = tz == NULL ? 0 : strlen(tz) < TZSZ ? 1 : -1;
+	if (zoneset == 1)
+		(void) strcpy(zonetz, tz);
+}
+
+/*
+ - findspan - the span holding t, working out the day around t if need be
+ */
+static struct span *
+findspan(t)
+time_t t;
+{
+	register int lo, hi, mid;
+	time_t d0, d1, a, b, c;
+	long off0, off1;
+	int dst0, dst1, dst;
+
+	zonecheck();
+	for (;;) {
+		for (lo = 0, hi = nspans; lo < hi; ) {
+			mid = (lo + hi) / 2;
+			if (t < spans[mid].start)
+				hi = mid;
+			else if (t >= spans[mid].end)
+				lo = mid + 1;
+			else
+				return (&spans[mid]);
+		}
+
+		d0 = t / daysec * daysec;
+		if (d0 > t)
+			d0 -= daysec;
+		d1 = d0 + daysec;
+		off0 = zoneoff(d0, &dst0);
+		off1 = zoneoff(d1 - 1, &dst1);
+		if (off0 == off1 && dst0 == dst1) {
+			addspan(d0, d1, off0, dst0);
+			continue;
+		}
+		/* the zone at a is as at d0, at b as at the end of the day */
+		for (a = d0, b = d1 - 1; b - a > 1; ) {
+			c = a + (b - a) / 2;
+			if (zoneoff(c, &dst) == off0 && dst == dst0)
+				a = c;
+			else
+				b = c;
+		}
+		addspan(d0, b, off0, dst0);
+		addspan(b, d1, off1, dst1);
+	}
+}
+
+/*
+ - zonetime - localtime() from the cached zone; the fields parse.c uses
+ */
+static struct tm *
+zonetime(t)
+time_t t;
+{
+	static struct tm tm;
+	register struct span *sp;
+	long z, era, doe, yoe, doy, mp, s;
+
+	sp = findspan(t);
+	t += sp->off;
+	z = t / daysec;
+	s = t % daysec;
+	if (s < 0) {
+		s += daysec;
+		z--;
+	}
+	tm.tm_hour = s / 3600;
+	tm.tm_min = s / 60 % 60;
+	tm.tm_sec = s % 60;
+	tm.tm_wday = (z % 7 + 11) % 7;
+	tm.tm_isdst = sp->isdst;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	tm.tm_mday = doy - (153 * mp + 2) / 5 + 1;
+	tm.tm_mon = mp < 10 ? mp + 2 : mp - 10;
+	tm.tm_year = yoe + era * 400 + (tm.tm_mon < 2) - 1900;
+	return (&tm);
+}
+
 static time_t
 dateconv(mm, dd, yy, h, m, s, mer, zone, dayflag)
 int mm, dd, yy, h, m, s, mer, zone, dayflag;
@@ -875,7 +1074,7 @@ int mm, dd, yy, h, m, s, mer, zone, dayflag;
 	jdate += zone * 60L;
 	if ((tod = timeconv(h, m, s, mer)) < 0) return (-1);
 	jdate += tod;
-	if (dayflag==DAYLIGHT || (dayflag==MAYBE&&localtime(&jdate)->tm_isdst))
+	if (dayflag==DAYLIGHT || (dayflag==MAYBE&&zonetime(jdate)->tm_isdst))
 		jdate += -1*60*60;
 	return (jdate);
 }
@@ -889,7 +1088,7 @@ int ord, day; time_t now;
 	time_t tod;
 
 	tod = now;
-	loctime = localtime(&tod);
+	loctime = zonetime(tod);
 	tod += daysec * ((day - loctime->tm_wday + 7) % 7);
 	tod += 7*daysec*(ord<=0?ord:ord-1);
 	return (daylcorr(tod, now));
@@ -921,7 +1120,7 @@ time_t sdate, relmonth;
 	int mm, yy;
 
 	if (relmonth == 0) return 0;
-	ltime = localtime(&sdate);
+	ltime = zonetime(sdate);
 	mm = 12*ltime->tm_year + ltime->tm_mon + relmonth;
 	yy = mm/12;
 	mm = mm%12 + 1;
@@ -936,8 +1135,8 @@ time_t future, now;
 {
 	int fdayl, nowdayl;
 
-	nowdayl = (localtime(&now)->tm_hour+1) % 24;
-	fdayl = (localtime(&future)->tm_hour+1) % 24;
+	nowdayl = (zonetime(now)->tm_hour+1) % 24;
+	fdayl = (zonetime(future)->tm_hour+1) % 24;
 	return (future-now) + 60L*60L*(nowdayl-fdayl);
 }
 
@@ -1226,6 +1425,94 @@ char *id;
 	return(ID);
 }
 
+/*
+ * The layouts machines write, parsed without the grammar:
+ *	@1760700000			seconds since the epoch
+ *	2026-10-17T12:34:56Z		ISO 8601 / RFC 3339; 'T' may be a
+ *					blank, seconds may have a fraction
+ *					and the zone may be Z, +hh:mm, -hh:mm
+ *					or absent (local time)
+ *	Oct 17 12:34:56			syslog, this year in local time
+ * The result is what the grammar would give for the same date.
+ */
+int fastparse = 1;
+
+#define isdig(c)	((unsigned)((c) - '0') < 10)
+#define dig2(s)		(((s)[0] - '0') * 10 + (s)[1] - '0')
+
+static char mnames[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+
+static time_t
+fastdate(p)
+register char *p;
+{
+	time_t t;
+	int mon, dd, zone, dayl;
+	register char *m;
+
+	if (*p == '@') {
+		if (!isdig(*++p))
+			return (-2);
+		for (t = 0; isdig(*p); p++)
+			t = 10 * t + *p - '0';
+		return (*p ? -2 : t);
+	}
+
+	if (isdig(p[0]) && isdig(p[1]) && isdig(p[2]) && isdig(p[3]) &&
+	    p[4] == '-' && isdig(p[5]) && isdig(p[6]) && p[7] == '-' &&
+	    isdig(p[8]) && isdig(p[9]) &&
+	    (p[10] == 'T' || p[10] == 't' || p[10] == ' ') &&
+	    isdig(p[11]) && isdig(p[12]) && p[13] == ':' &&
+	    isdig(p[14]) && isdig(p[15]) && p[16] == ':' &&
+	    isdig(p[17]) && isdig(p[18])) {
+		m = p + 19;
+		if (*m == '.' || *m == ',')
+			while (isdig(*++m))
+				;
+		zone = ourzone;
+		dayl = MAYBE;
+		if ((*m == 'Z' || *m == 'z') && m[1] == '\0') {
+			zone = 0;
+			dayl = STANDARD;
+		} else if ((*m == '+' || *m == '-') && isdig(m[1]) &&
+		    isdig(m[2]) && m[3] == ':' && isdig(m[4]) &&
+		    isdig(m[5]) && m[6] == '\0') {
+			zone = dig2(m + 1) * 60 + dig2(m + 4);
+			if (*m == '+')
+				zone = -zone;
+			dayl = STANDARD;
+		} else if (*m != '\0')
+			return (-2);
+		return (dateconv(dig2(p + 5), dig2(p + 8),
+		    dig2(p) * 100 + dig2(p + 2), dig2(p + 11), dig2(p + 14),
+		    dig2(p + 17), 24, zone, dayl));
+	}
+
+	if (isalpha(p[0]) && isalpha(p[1]) && isalpha(p[2]) && p[3] == ' ') {
+		for (m = mnames, mon = 1; *m; m += 3, mon++)
+			if ((p[0] | 040) == m[0] && (p[1] | 040) == m[1] &&
+			    (p[2] | 040) == m[2])
+				break;
+		if (*m == '\0')
+			return (-2);
+		p += 4;
+		if (*p == ' ')
+			p++;
+		if (!isdig(*p))
+			return (-2);
+		dd = *p++ - '0';
+		if (isdig(*p))
+			dd = 10 * dd + *p++ - '0';
+		if (p[0] != ' ' || !isdig(p[1]) || !isdig(p[2]) ||
+		    p[3] != ':' || !isdig(p[4]) || !isdig(p[5]) ||
+		    p[6] != ':' || !isdig(p[7]) || !isdig(p[8]) || p[9] != '\0')
+			return (-2);
+		return (dateconv(mon, dd, year, dig2(p + 1), dig2(p + 4),
+		    dig2(p + 7), 24, ourzone, MAYBE));
+	}
+	return (-2);
+}
+
 time_t
 parse(p, now)
 char *p;
@@ -1239,12 +1526,16 @@ struct timeb *now;
 
 	time_t sdate, tod;
 
+	/* the epoch needs none of the local time set up below */
+	if (fastparse && *p == '@' && (sdate = fastdate(p)) != -2)
+		return (sdate);
+
 	lptr = p;
 	if (now == ((struct timeb *) NULL)) {
 		now = &ftz;
 		ftime(&ftz);
 	}
-	lt = localtime(&now->time);
+	lt = zonetime(now->time);
 	year = lt->tm_year;
 	month = lt->tm_mon+1;
 	day = lt->tm_mday;
@@ -1255,6 +1546,7 @@ struct timeb *now;
 	hh = mm = ss = 0;
 	merid = 24;
 
+	if (fastparse && (sdate = fastdate(p)) != -2) return (sdate);
 	if (err = yyparse()) return (-1);
 
 	mcheck(timeflag);
@@ -0,0 +1,137 @@
+/*
+ * procstat - parse /proc/<pid>/stat and statm in place.  comm may hold
+ * blanks and parentheses, so the fixed fields start after the last ')';
+ * from there the fields not asked for are skipped and the rest decoded
+ * four digits a step, with no copy, sscanf or strtoul.
+ */
+char pident[] = "@(#) procstat.c 1.1 26/10/19";
+#include <string.h>
+#include <ctype.h>
+#include "procstat.h"
+
+#define	DIGIT(c)	((unsigned) ((c) - '0') < 10)
+
+/* stat field numbers, counting pid as 1 */
+#define	F_STATE		3
+#define	F_PPID		4
+#define	F_MINFLT	10
+#define	F_MAJFLT	12
+#define	F_THREADS	20
+#define	F_START		22
+#define	F_VSIZE		23
+#define	F_RSS		24
+
+/*
+ - decimal - decode the unsigned number at *pp, leaving *pp at the blank
+ - after it; -1 in *bad if there is no number or it ends badly
+ */
+static unsigned long long
+decimal(char **pp, int *bad)
+{
+	char *p = *pp;
+	unsigned long long v = 0;
+
+	if (!DIGIT(*p)) {
+		*bad = -1;
+		return 0;
+	}
+	for (;;) {
+		v = v * 10 + (p[0] - '0');
+		if (!DIGIT(p[1])) {
+			p += 1;
+			break;
+		}
+		v = v * 10 + (p[1] - '0');
+		if (!DIGIT(p[2])) {
+			p += 2;
+			break;
+		}
+		v = v * 10 + (p[2] - '0');
+		if (!DIGIT(p[3])) {
+			p += 3;
+			break;
+		}
+		v = v * 10 + (p[3] - '0');
+		p += 4;
+		if (!DIGIT(*p))
+			break;
+	}
+	if (*p != ' ' && *p != '\n' && *p != '\0')
+		*bad = -1;
+	*pp = p;
+	return v;
+}
+
+/*
+ - skip - step *pp over n blank separated fields
+ */
+static void
+skip(char **pp, int n, int *bad)
+{
+	char *p = *pp;
+
+	while (n-- > 0) {
+		while (*p != ' ' && *p != '\0')
+			p++;
+		if (*p == '\0') {
+			*bad = -1;
+			break;
+		}
+		p++;
+	}
+	*pp = p;
+}
+
+/*
+ - procstat - fill in ps from NUL terminated stat and statm buffers,
+ - decoding the stat fields in want; blanks in comm become '_'.  -1 if
+ - either buffer is malformed.
+ */
+int
+procstat(char *stat, char *statm, struct pstat *ps, int want)
+{
+	char *comm, *end, *p;
+	int at, bad = 0;
+
+	if ((comm = strchr(stat, '(')) == NULL ||
+	    (end = strrchr(stat, ')')) == NULL || end < comm ||
+	    end[1] != ' ' || end[2] == '\0')
+		return -1;
+	*end = '\0';
+	for (p = ++comm; *p; p++)
+		if (isspace((unsigned char) *p))
+			*p = '_';
+	ps->comm = comm;
+	ps->state = (unsigned char) end[2];
+
+	/* p is at the start of field at, or on the blank that ends it */
+	p = end + 2;
+	at = F_STATE;
+#define	FIELD(n, lhs)	{ skip(&p, (n) - at, &bad); at = (n); \
+			  lhs = decimal(&p, &bad); }
+	if (want & PS_PPID)
+		FIELD(F_PPID, ps->ppid);
+	if (want & PS_FAULTS) {
+		FIELD(F_MINFLT, ps->minflt);
+		FIELD(F_MAJFLT, ps->majflt);
+	}
+	if (want & PS_THREADS)
+		FIELD(F_THREADS, ps->threads);
+	if (want & PS_START)
+		FIELD(F_START, ps->start);
+	if (want & PS_VSIZE)
+		FIELD(F_VSIZE, ps->vsize);
+	if (want & PS_RSS)
+		FIELD(F_RSS, ps->rss);
+#undef	FIELD
+	if (bad)
+		return -1;
+
+	p = statm;
+	ps->size = decimal(&p, &bad);
+	if (*p == ' ') {
+		p++;
+		ps->resident = decimal(&p, &bad);
+	}
+	return bad;
+}
@@ -0,0 +1,32 @@
+/*
+ * procstat.h - the fields of /proc/<pid>/stat and statm that memmon uses
+ * @(#) procstat.h 1.1 26/10/19
+ */
+
+/*
+ * A parsed sample.  comm points into the stat buffer, which procstat()
+ * cuts at the end of the name; only the fields asked for are set.
+ */
+struct pstat {
+	char	*comm;
+	int	state;
+	int	ppid;			/* PS_PPID */
+	unsigned long minflt;		/* PS_FAULTS */
+	unsigned long majflt;
+	long	threads;		/* PS_THREADS */
+	unsigned long long start;	/* PS_START, clock ticks after boot */
+	unsigned long vsize;		/* PS_VSIZE, bytes */
+	unsigned long rss;		/* PS_RSS, pages */
+	unsigned long size;		/* statm: total pages */
+	unsigned long resident;		/* statm: resident pages */
+};
+
+#define	PS_PPID		0x01
+#define	PS_FAULTS	0x02
+#define	PS_START	0x04
+#define	PS_VSIZE	0x08
+#define	PS_RSS		0x10
+#define	PS_THREADS	0x20
+#define	PS_ALL		0x3f
+
+extern int procstat();
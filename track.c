@@ -0,0 +1,495 @@
+/*
+ * libmemmon-track - an LD_PRELOAD shim that samples the allocation call
+ * sites of a process once memmon has flagged it.  It loads dormant: every
+ * malloc, free and mmap goes straight through, at the cost of one test of
+ * a flag.  The first MEMMON_TRACK_SIGNAL (SIGUSR2 by default) arms it;
+ * from then on every MEMMON_TRACK_RATE'th call (100) records its stack
+ * in a buffer of the calling thread.  Each signal after that asks for a
+ * report: the next allocation drains the buffers and writes the stacks
+ * that allocated most since arming to memmon-track.<pid> in
+ * MEMMON_TRACK_DIR (/tmp).  The signal is a number or USR1, USR2 or
+ * RTMIN+n, with or without SIG.
+ *
+ *	LD_PRELOAD=libmemmon-track.so service ...
+ */
+#define	_GNU_SOURCE
+char tident[] = "@(#) track.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define	ARMED		0x1
+#define	DUMP		0x2
+#define	DEPTH		8	/* frames kept per sample */
+#define	SKIP		2	/* frames of the shim itself */
+#define	NREC		4096	/* samples buffered per thread */
+#define	NSTACK		8192	/* distinct stacks in a report, a power of 2 */
+#define	TOP		20	/* stacks listed */
+
+enum { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_MEMALIGN, OP_MMAP, OP_FREE,
+	OP_MUNMAP, NOP };
+static char *opname[NOP] = { "malloc", "calloc", "realloc", "memalign",
+	"mmap", "free", "munmap" };
+
+/*
+ * One sampled call.
+ */
+struct rec {
+	int	op;
+	int	depth;
+	size_t	size;
+	void	*pc[DEPTH];
+};
+
+/*
+ * A thread's samples.  The thread is the only writer of head and the
+ * reporting thread the only writer of tail, so neither takes a lock; a
+ * sample that finds the buffer full is counted in lost.  The buffer of a
+ * thread that exits is handed to the next thread to start sampling.
+ */
+struct tbuf {
+	struct tbuf *next;
+	unsigned head, tail;
+	unsigned long lost;
+	int	idle;
+	struct rec r[NREC];
+};
+
+/*
+ * The samples of one stack since arming, scaled by the rate.
+ */
+struct stack {
+	int	op;
+	int	depth;
+	void	*pc[DEPTH];
+	unsigned long calls;
+	unsigned long long bytes;
+};
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+static volatile sig_atomic_t armed;
+static int reporting;			/* a report is being written */
+static struct timespec armed_at;
+static long rate = 100;
+static int signo = SIGUSR2;
+static char dir[256] = "/tmp";
+static struct tbuf *buffers;		/* every buffer, pushed at the head */
+static pthread_key_t key;
+static struct stack *stacks;		/* NSTACK, mapped on the first report */
+static unsigned long nsampled, nlost;
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_munmap)(void *, size_t);
+
+static __thread struct tbuf *tb;
+static __thread int busy;		/* in the shim: let calls straight through */
+static __thread long countdown;
+
+static void sample();
+static void report();
+static void dump();
+
+/*
+ - arm - the signal handler: arm the shim, or if it is armed ask for a
+ - report at the next allocation
+ */
+static void
+arm(int sig)
+{
+	if (armed & ARMED)
+		(void) __atomic_fetch_or(&armed, DUMP, __ATOMIC_RELEASE);
+	else {
+		(void) clock_gettime(CLOCK_REALTIME, &armed_at);
+		__atomic_store_n(&armed, ARMED, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ - retire - hand the buffer of an exiting thread to the next one
+ */
+static void
+retire(void *p)
+{
+	__atomic_store_n(&((struct tbuf *) p)->idle, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ - signame - the number of a signal given as a name or number, 0 if it
+ - is not one the shim takes
+ */
+static int
+signame(char *s)
+{
+	char *end;
+	long n;
+
+	if (strncmp(s, "SIG", 3) == 0)
+		s += 3;
+	if (strcmp(s, "USR1") == 0)
+		return SIGUSR1;
+	if (strcmp(s, "USR2") == 0)
+		return SIGUSR2;
+	if (strncmp(s, "RTMIN", 5) == 0) {
+		if (s[5] == '\0')
+			return SIGRTMIN;
+		if (s[5] != '+' || s[6] < '0' || s[6] > '9')
+			return 0;
+		n = SIGRTMIN + strtol(s + 6, &end, 10);
+		return *end == '\0' && n <= SIGRTMAX ? n : 0;
+	}
+	if (*s < '0' || *s > '9')
+		return 0;
+	n = strtol(s, &end, 10);
+	return *end == '\0' && n > 0 && n < NSIG ? n : 0;
+}
+
+/*
+ - setup - read the settings and catch the signal; run before main
+ */
+__attribute__((constructor))
+static void
+setup(void)
+{
+	struct sigaction sa;
+	void *pc[1];
+	char *s;
+
+	if ((s = getenv("MEMMON_TRACK_RATE")) != NULL && atol(s) > 0)
+		rate = atol(s);
+	if ((s = getenv("MEMMON_TRACK_SIGNAL")) != NULL && signame(s) > 0)
+		signo = signame(s);
+	if ((s = getenv("MEMMON_TRACK_DIR")) != NULL && *s)
+		(void) snprintf(dir, sizeof(dir), "%s", s);
+	(void) pthread_key_create(&key, retire);
+
+	/* backtrace loads the unwinder, which allocates, on first use */
+	busy = 1;
+	(void) backtrace(pc, 1);
+	busy = 0;
+
+	(void) memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = arm;
+	sa.sa_flags = SA_RESTART;
+	(void) sigemptyset(&sa.sa_mask);
+	(void) sigaction(signo, &sa, NULL);
+}
+
+/*
+ * The hooks.  While dormant each is the libc call and one branch.
+ */
+void *
+malloc(size_t n)
+{
+	void *p = __libc_malloc(n);
+
+	if (__builtin_expect(armed, 0))
+		sample(OP_MALLOC, n);
+	return p;
+}
+
+void *
+calloc(size_t n, size_t m)
+{
+	void *p = __libc_calloc(n, m);
+
+	if (__builtin_expect(armed, 0))
+		sample(OP_CALLOC, n * m);
+	return p;
+}
+
+void *
+realloc(void *o, size_t n)
+{
+	void *p = __libc_realloc(o, n);
+
+	if (__builtin_expect(armed, 0))
+		sample(OP_REALLOC, n);
+	return p;
+}
+
+void *
+memalign(size_t a, size_t n)
+{
+	void *p = __libc_memalign(a, n);
+
+	if (__builtin_expect(armed, 0))
+		sample(OP_MEMALIGN, n);
+	return p;
+}
+
+void *
+aligned_alloc(size_t a, size_t n)
+{
+	return memalign(a, n);
+}
+
+int
+posix_memalign(void **pp, size_t a, size_t n)
+{
+	void *p;
+
+	if (a < sizeof(void *) || (a & (a - 1)) != 0)
+		return 22;	/* EINVAL */
+	if ((p = memalign(a, n)) == NULL && n != 0)
+		return 12;	/* ENOMEM */
+	*pp = p;
+	return 0;
+}
+
+void
+free(void *p)
+{
+	if (__builtin_expect(armed, 0) && p != NULL)
+		sample(OP_FREE, malloc_usable_size(p));
+	__libc_free(p);
+}
+
+void *
+mmap(void *a, size_t n, int prot, int flags, int fd, off_t off)
+{
+	void *p;
+
+	if (real_mmap == NULL)
+		real_mmap = dlsym(RTLD_NEXT, "mmap");
+	p = real_mmap != NULL ? real_mmap(a, n, prot, flags, fd, off) :
+	    (void *) syscall(SYS_mmap, a, n, prot, flags, fd, off);
+	if (__builtin_expect(armed, 0))
+		sample(OP_MMAP, n);
+	return p;
+}
+
+int
+munmap(void *a, size_t n)
+{
+	if (real_munmap == NULL)
+		real_munmap = dlsym(RTLD_NEXT, "munmap");
+	if (__builtin_expect(armed, 0))
+		sample(OP_MUNMAP, n);
+	return real_munmap != NULL ? real_munmap(a, n) :
+	    (int) syscall(SYS_munmap, a, n);
+}
+
+/*
+ - getbuf - the calling thread's buffer: an idle one if there is one,
+ - else a new one mapped outside the heap being watched
+ */
+static struct tbuf *
+getbuf(void)
+{
+	struct tbuf *b;
+	int one = 1;
+
+	for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next)
+		if (__atomic_compare_exchange_n(&b->idle, &one, 0, 0,
+		    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+		else
+			one = 1;
+	if (b == NULL) {
+		b = (struct tbuf *) syscall(SYS_mmap, NULL, sizeof(*b),
+		    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b == MAP_FAILED)
+			return NULL;
+		b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&buffers, &b->next, b, 0,
+		    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	(void) pthread_setspecific(key, b);
+	return b;
+}
+
+/*
+ - sample - count down to the next sample and record its stack; write a
+ - report first if one was asked for.  Nothing is sampled while another
+ - thread writes a report
+ */
+__attribute__((noinline))
+static void
+sample(int op, size_t size)
+{
+	struct rec *r;
+	void *pc[DEPTH + SKIP];
+	unsigned head;
+	int n;
+
+	if (busy || __atomic_load_n(&reporting, __ATOMIC_ACQUIRE))
+		return;
+	busy = 1;
+	if (__atomic_fetch_and(&armed, ~DUMP, __ATOMIC_ACQ_REL) & DUMP)
+		report();
+	if (--countdown <= 0) {
+		countdown = rate;
+		if (tb == NULL)
+			tb = getbuf();
+		if (tb != NULL) {
+			head = tb->head;
+			if (head - __atomic_load_n(&tb->tail, __ATOMIC_ACQUIRE) >= NREC)
+				tb->lost++;
+			else {
+				r = &tb->r[head % NREC];
+				n = backtrace(pc, DEPTH + SKIP) - SKIP;
+				r->op = op;
+				r->size = size;
+				r->depth = n > 0 ? n : 0;
+				if (n > 0)
+					(void) memcpy(r->pc, pc + SKIP, n * sizeof(void *));
+				__atomic_store_n(&tb->head, head + 1, __ATOMIC_RELEASE);
+			}
+		}
+	}
+	busy = 0;
+}
+
+/*
+ - account - add a sample to the stack table
+ */
+static void
+account(struct rec *r)
+{
+	unsigned long h = r->op;
+	struct stack *s;
+	int i;
+
+	for (i = 0; i < r->depth; i++)
+		h = (h ^ (unsigned long) r->pc[i]) * 0x100000001b3UL;
+	for (i = 0; i < NSTACK; i++) {
+		s = &stacks[(h + i) & (NSTACK - 1)];
+		if (s->calls == 0) {
+			s->op = r->op;
+			s->depth = r->depth;
+			(void) memcpy(s->pc, r->pc, r->depth * sizeof(void *));
+			break;
+		}
+		if (s->op == r->op && s->depth == r->depth &&
+		    memcmp(s->pc, r->pc, r->depth * sizeof(void *)) == 0)
+			break;
+	}
+	if (i == NSTACK) {
+		nlost++;
+		return;
+	}
+	s->calls += rate;
+	s->bytes += (unsigned long long) r->size * rate;
+	nsampled++;
+}
+
+static int
+bybytes(const void *a, const void *b)
+{
+	const struct stack *x = *(struct stack **) a, *y = *(struct stack **) b;
+
+	return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+/*
+ - frame - name pc as symbol+offset, or object+offset without symbols
+ */
+static int
+frame(char *buf, int len, void *pc)
+{
+	Dl_info di;
+	char *obj;
+
+	if (dladdr(pc, &di) == 0 || di.dli_fname == NULL)
+		return snprintf(buf, len, " %p", pc);
+	if (di.dli_sname != NULL)
+		return snprintf(buf, len, " %s+%#lx", di.dli_sname,
+		    (unsigned long) ((char *) pc - (char *) di.dli_saddr));
+	obj = strrchr(di.dli_fname, '/');
+	return snprintf(buf, len, " %s+%#lx", obj ? obj + 1 : di.dli_fname,
+	    (unsigned long) ((char *) pc - (char *) di.dli_fbase));
+}
+
+/*
+ - report - write a report unless another thread is writing one, in
+ - which case the request is dropped
+ */
+static void
+report(void)
+{
+	int idle = 0;
+
+	if (!__atomic_compare_exchange_n(&reporting, &idle, 1, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	dump();
+	__atomic_store_n(&reporting, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ - dump - drain every thread's buffer into the stack table and write
+ - the allocating stacks, most bytes first, to memmon-track.<pid>
+ */
+static void
+dump(void)
+{
+	static struct stack *top[NSTACK];
+	char path[300], tmp[310], line[1024];
+	struct tbuf *b;
+	unsigned t, h;
+	unsigned long long freed = 0;
+	int fd, i, j, n, len;
+
+	if (stacks == NULL) {
+		stacks = (struct stack *) syscall(SYS_mmap, NULL,
+		    NSTACK * sizeof(*stacks), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (stacks == MAP_FAILED) {
+			stacks = NULL;
+			return;
+		}
+	}
+	for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+		h = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+		for (t = b->tail; t != h; t++)
+			account(&b->r[t % NREC]);
+		__atomic_store_n(&b->tail, h, __ATOMIC_RELEASE);
+		nlost += __atomic_exchange_n(&b->lost, 0, __ATOMIC_RELAXED);
+	}
+
+	for (i = n = 0; i < NSTACK; i++)
+		if (stacks[i].calls == 0)
+			continue;
+		else if (stacks[i].op >= OP_FREE)
+			freed += stacks[i].bytes;
+		else
+			top[n++] = &stacks[i];
+	qsort(top, n, sizeof(top[0]), bybytes);
+
+	(void) snprintf(path, sizeof(path), "%s/memmon-track.%d", dir, (int) getpid());
+	(void) snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return;
+	len = snprintf(line, sizeof(line),
+	    "# pid %d armed %ld rate 1/%ld sampled %lu lost %lu freed %llu\n"
+	    "# bytes calls op stack\n", (int) getpid(), (long) armed_at.tv_sec,
+	    rate, nsampled, nlost, freed);
+	(void) write(fd, line, len);
+	for (i = 0; i < n && i < TOP; i++) {
+		len = snprintf(line, sizeof(line), "%llu %lu %s", top[i]->bytes,
+		    top[i]->calls, opname[top[i]->op]);
+		for (j = 0; j < top[i]->depth && len < sizeof(line) - 1; j++)
+			len += frame(line + len, sizeof(line) - 1 - len, top[i]->pc[j]);
+		if (len > sizeof(line) - 2)
+			len = sizeof(line) - 2;
+		line[len++] = '\n';
+		(void) write(fd, line, len);
+	}
+	(void) close(fd);
+	(void) rename(tmp, path);
+}
@@ -0,0 +1,146 @@
+/*
+ * uring - just enough of an io_uring to batch the /proc reads of
+ * memscan, without depending on liburing
+ */
+char uident[] = "@(#) uring.c 1.1 26/10/19";
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int ringfd = -1;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned sq_entries, queued;
+
+/* OPENAT, READ and CLOSE arrived in 5.6, together with the probe */
+static int needops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+
+/*
+ - uring_init - set up a ring of at least entries submissions;
+ - -1 if the kernel, or a sandbox in front of it, will not have it
+ */
+int
+uring_init(unsigned entries)
+{
+	struct io_uring_params p;
+	struct io_uring_probe *probe;
+	size_t sqsz, cqsz;
+	char *sq, *cq;
+	int i, op;
+
+	(void) memset(&p, 0, sizeof(p));
+	if ((ringfd = (int) syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return -1;
+
+	probe = calloc(1, sizeof(*probe) + 256 * sizeof(probe->ops[0]));
+	if (probe == NULL || syscall(__NR_io_uring_register, ringfd,
+	    IORING_REGISTER_PROBE, probe, 256) < 0)
+		goto fail;
+	for (i = 0; i < sizeof(needops) / sizeof(needops[0]); i++) {
+		op = needops[i];
+		if (op > probe->last_op ||
+		    !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			goto fail;
+	}
+	free(probe);
+	probe = NULL;
+
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cqsz > sqsz)
+			sqsz = cqsz;
+		cqsz = sqsz;
+	}
+	sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    ringfd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else if ((cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto fail;
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+	    IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto fail;
+
+	sq_head = (unsigned *) (sq + p.sq_off.head);
+	sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	sq_array = (unsigned *) (sq + p.sq_off.array);
+	cq_head = (unsigned *) (cq + p.cq_off.head);
+	cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	sq_entries = p.sq_entries;
+	return 0;
+
+fail:
+	free(probe);
+	(void) close(ringfd);
+	ringfd = -1;
+	return -1;
+}
+
+/*
+ - uring_sqe - the next free submission entry, cleared, or NULL if the
+ - ring is full and must be drained with uring_wait first
+ */
+struct io_uring_sqe *
+uring_sqe()
+{
+	unsigned i;
+
+	if (queued == sq_entries)
+		return NULL;
+	i = (*sq_tail + queued++) & *sq_mask;
+	sq_array[i] = i;
+	(void) memset(&sqes[i], 0, sizeof(sqes[i]));
+	return &sqes[i];
+}
+
+/*
+ - uring_wait - submit everything queued and hand every completion to
+ - done(user_data, res); returns the number of system calls it took
+ */
+int
+uring_wait(void (*done)(unsigned long long, int))
+{
+	unsigned n, sub, got, head, tail;
+	struct io_uring_cqe *cqe;
+	long r;
+	int calls = 0;
+
+	if ((n = queued) == 0)
+		return 0;
+	__atomic_store_n(sq_tail, *sq_tail + n, __ATOMIC_RELEASE);
+	queued = 0;
+
+	for (sub = n, got = 0; got < n; ) {
+		r = syscall(__NR_io_uring_enter, ringfd, sub, n - got,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+		calls++;
+		if (r < 0 && errno != EINTR)
+			return -1;
+		if (r > 0)
+			sub -= r < sub ? r : sub;
+		head = *cq_head;
+		tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, got++) {
+			cqe = &cqes[head & *cq_mask];
+			(*done)(cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+	return calls;
+}